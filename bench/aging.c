@@ -0,0 +1,49 @@
+// Fragmentation aging: a long-lived heap goes through phases that free a
+// random half of it and refill it with a different size mix. Peak RSS
+// against the live bytes shows how well free space is reused over time.
+#include "bench.h"
+
+#define LIVE 65536
+#define PHASES 14
+
+static void *slots[LIVE];
+static size_t sizes[LIVE];
+
+int main(int argc, char **argv) {
+    Bench bench;
+    BenchLatency latency;
+    size_t live_bytes = 0;
+
+    bench_init(&bench, argc, argv);
+    memset(&latency, 0, sizeof(latency));
+
+    uint64_t start = bench_now();
+    for (size_t phase = 0; phase < PHASES * bench.scale; phase++) {
+        // Each phase favours a different band of sizes
+        size_t max = (size_t)64 << (phase % 7);
+
+        for (int i = 0; i < LIVE; i++) {
+            if (slots[i] && bench_random(&bench.rng) % 2) continue;
+
+            uint64_t t0 = bench_now();
+            free(slots[i]);
+            if (slots[i]) bench_record(&latency, bench_now() - t0);
+            live_bytes -= sizes[i];
+
+            sizes[i] = bench_random_size(&bench.rng, 8, max);
+            t0 = bench_now();
+            slots[i] = malloc(sizes[i]);
+            bench_record(&latency, bench_now() - t0);
+
+            ((char *)slots[i])[0] = (char)i;
+            live_bytes += sizes[i];
+        }
+    }
+    uint64_t elapsed = bench_now() - start;
+
+    bench_report(&bench, "aging-64-4096", &latency, elapsed);
+    printf("%-22s %-10s %10zu KB live at end\n", "aging-64-4096", bench.allocator, live_bytes / 1024);
+
+    for (int i = 0; i < LIVE; i++) free(slots[i]);
+    return 0;
+}
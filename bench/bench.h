@@ -0,0 +1,186 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+// Latencies go into log2 buckets split into 8 linear sub-buckets, which
+// keeps percentiles within 12.5% without the harness ever calling malloc
+#define BENCH_SUB_BUCKETS 8
+#define BENCH_BUCKETS (64 * BENCH_SUB_BUCKETS)
+
+#define BENCH_MAX_THREADS 256
+
+typedef struct BenchLatency {
+    uint64_t ops;
+    uint64_t buckets[BENCH_BUCKETS];
+} BenchLatency;
+
+typedef struct Bench {
+    const char *allocator;
+    size_t scale;
+    int max_threads;
+    uint64_t rng;
+} Bench;
+
+typedef struct BenchWorker {
+    Bench *bench;
+    int id;
+    int threads;
+    uint64_t rng;
+    uint64_t ops;
+    void *data;
+} BenchWorker;
+
+static inline uint64_t bench_now(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+}
+
+static inline uint64_t bench_random(uint64_t *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+// Sizes spread evenly over powers of two, like real heaps, rather than
+// uniformly over bytes
+static inline size_t bench_random_size(uint64_t *state, size_t min, size_t max) {
+    uint64_t value = bench_random(state);
+    int bits = 64 - __builtin_clzll(max);
+    size_t size = (size_t)1 << (value % (uint64_t)bits);
+
+    size += (size_t)(value >> 32) & (size - 1);
+    if (size < min) size = min;
+    if (size > max) size = max;
+    return size;
+}
+
+static inline void bench_record(BenchLatency *latency, uint64_t ns) {
+    int bucket = 0;
+
+    if (ns >= BENCH_SUB_BUCKETS) {
+        int shift = 63 - __builtin_clzll(ns) - 3;
+        bucket = (shift + 1) * BENCH_SUB_BUCKETS + (int)((ns >> shift) & (BENCH_SUB_BUCKETS - 1));
+    } else {
+        bucket = (int)ns;
+    }
+    latency->buckets[bucket]++;
+    latency->ops++;
+}
+
+static inline uint64_t bench_bucket_value(int bucket) {
+    if (bucket < BENCH_SUB_BUCKETS) return (uint64_t)bucket;
+
+    int shift = bucket / BENCH_SUB_BUCKETS - 1;
+    return ((uint64_t)(BENCH_SUB_BUCKETS + bucket % BENCH_SUB_BUCKETS) << shift);
+}
+
+static inline uint64_t bench_percentile(BenchLatency *latency, uint64_t per_mille) {
+    uint64_t rank = (latency->ops * per_mille + 999) / 1000;
+    uint64_t seen = 0;
+
+    for (int i = 0; i < BENCH_BUCKETS; i++) {
+        seen += latency->buckets[i];
+        if (seen && seen >= rank) return bench_bucket_value(i);
+    }
+    return 0;
+}
+
+static inline void bench_merge(BenchLatency *into, BenchLatency *from) {
+    into->ops += from->ops;
+    for (int i = 0; i < BENCH_BUCKETS; i++) into->buckets[i] += from->buckets[i];
+}
+
+static inline long bench_peak_rss_kb(void) {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+// Current resident set, read without stdio so it does not allocate
+static inline long bench_rss_kb(void) {
+    char buffer[128];
+    long pages = 0;
+    int fd = open("/proc/self/statm", O_RDONLY);
+
+    if (fd < 0) return 0;
+    ssize_t length = read(fd, buffer, sizeof(buffer) - 1);
+    close(fd);
+    if (length <= 0) return 0;
+    buffer[length] = '\0';
+
+    char *field = strchr(buffer, ' ');
+    if (field) pages = atol(field + 1);
+    return pages * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+// Usage: <bench> [allocator label] [scale] [max threads]. The label only
+// names the row; which allocator runs is decided by LD_PRELOAD.
+static inline void bench_init(Bench *bench, int argc, char **argv) {
+    bench->allocator = (argc > 1) ? argv[1] : "default";
+    bench->scale = (argc > 2 && atoi(argv[2]) > 0) ? (size_t)atoi(argv[2]) : 1;
+    bench->max_threads = (argc > 3 && atoi(argv[3]) > 0) ? atoi(argv[3]) : 8;
+    if (bench->max_threads > BENCH_MAX_THREADS) bench->max_threads = BENCH_MAX_THREADS;
+    bench->rng = 0x9E3779B97F4A7C15ULL;
+}
+
+// Thread counts double from 1 and always end on the maximum itself
+static inline int bench_next_threads(Bench *bench, int threads) {
+    if (threads >= bench->max_threads) return 0;
+    return (threads * 2 < bench->max_threads) ? threads * 2 : bench->max_threads;
+}
+
+// Peak RSS is the process high-water mark, so it only grows from one row to
+// the next within a binary
+static inline void bench_report(Bench *bench, const char *name, BenchLatency *latency, uint64_t elapsed_ns) {
+    double seconds = (double)elapsed_ns / 1e9;
+
+    printf("%-22s %-10s %10.2f Mops/s  p50 %6llu ns  p99 %7llu ns  peak RSS %8ld KB\n",
+           name, bench->allocator, (double)latency->ops / seconds / 1e6,
+           (unsigned long long)bench_percentile(latency, 500),
+           (unsigned long long)bench_percentile(latency, 990),
+           bench_peak_rss_kb());
+    fflush(stdout);
+}
+
+// Starts one worker per thread on the same routine and waits for all of
+// them; returns the wall time from first start to last join
+static inline uint64_t bench_run_workers(Bench *bench, int threads, void *(*run)(void *), BenchWorker *workers, void *data) {
+    pthread_t ids[BENCH_MAX_THREADS];
+
+    uint64_t start = bench_now();
+    for (int i = 0; i < threads; i++) {
+        workers[i] = (BenchWorker){bench, i, threads, bench->rng + (uint64_t)i * 0x9E3779B97F4A7C15ULL, 0, data};
+        pthread_create(&ids[i], NULL, run, &workers[i]);
+    }
+    for (int i = 0; i < threads; i++) pthread_join(ids[i], NULL);
+    return bench_now() - start;
+}
+
+static inline uint64_t bench_total_ops(BenchWorker *workers, int threads) {
+    uint64_t ops = 0;
+    for (int i = 0; i < threads; i++) ops += workers[i].ops;
+    return ops;
+}
+
+// One CSV row per run: benchmark,allocator,threads,seconds,mops
+static inline void bench_csv(Bench *bench, const char *name, int threads, uint64_t ops, uint64_t elapsed_ns) {
+    double seconds = (double)elapsed_ns / 1e9;
+
+    printf("%s,%s,%d,%.4f,%.3f\n", name, bench->allocator, threads, seconds,
+           (double)ops / seconds / 1e6);
+    fflush(stdout);
+}
+
+#endif
@@ -0,0 +1,39 @@
+// Zeroing: calloc() of mixed sizes up to 64 KB into slots that are freed
+// and refilled, so most requests land on reused, dirty memory that has to
+// be cleared rather than on fresh pages the kernel already zeroed
+#include "bench.h"
+
+#define SLOTS 64
+#define MAX_SIZE (64 * 1024)
+
+static void *slots[SLOTS];
+
+int main(int argc, char **argv) {
+    Bench bench;
+    BenchLatency latency;
+
+    bench_init(&bench, argc, argv);
+    memset(&latency, 0, sizeof(latency));
+
+    size_t steps = 200000 * bench.scale;
+    uint64_t start = bench_now();
+    for (size_t step = 0; step < steps; step++) {
+        size_t slot = bench_random(&bench.rng) % SLOTS;
+        size_t size = bench_random_size(&bench.rng, 16, MAX_SIZE);
+
+        free(slots[slot]);
+        uint64_t t0 = bench_now();
+        char *ptr = calloc(1, size);
+        bench_record(&latency, bench_now() - t0);
+
+        // Dirty it again for whoever gets the memory next
+        ptr[0] = (char)step;
+        ptr[size - 1] = (char)step;
+        slots[slot] = ptr;
+    }
+    uint64_t elapsed = bench_now() - start;
+
+    for (int i = 0; i < SLOTS; i++) free(slots[i]);
+    bench_report(&bench, "calloc-zeroing", &latency, elapsed);
+    return 0;
+}
@@ -0,0 +1,43 @@
+// Fixed-size churn: a window of live blocks of one size, where each step
+// frees a random slot and allocates it again
+#include "bench.h"
+
+#define MAX_WINDOW 4096
+
+static void *slots[MAX_WINDOW];
+
+static void run_churn(Bench *bench, const char *name, size_t size, size_t window, size_t steps) {
+    BenchLatency latency;
+    memset(&latency, 0, sizeof(latency));
+
+    for (size_t i = 0; i < window; i++) slots[i] = malloc(size);
+
+    uint64_t start = bench_now();
+    for (size_t step = 0; step < steps; step++) {
+        size_t slot = bench_random(&bench->rng) % window;
+
+        uint64_t t0 = bench_now();
+        free(slots[slot]);
+        uint64_t t1 = bench_now();
+        slots[slot] = malloc(size);
+        uint64_t t2 = bench_now();
+
+        ((char *)slots[slot])[0] = (char)step;
+        bench_record(&latency, t1 - t0);
+        bench_record(&latency, t2 - t1);
+    }
+    uint64_t elapsed = bench_now() - start;
+
+    for (size_t i = 0; i < window; i++) free(slots[i]);
+    bench_report(bench, name, &latency, elapsed);
+}
+
+int main(int argc, char **argv) {
+    Bench bench;
+    bench_init(&bench, argc, argv);
+
+    run_churn(&bench, "churn-tiny-64", 64, MAX_WINDOW, 2000000 * bench.scale);
+    run_churn(&bench, "churn-small-1024", 1024, MAX_WINDOW, 1000000 * bench.scale);
+    run_churn(&bench, "churn-large-65536", 65536, 256, 20000 * bench.scale);
+    return 0;
+}
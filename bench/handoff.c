@@ -0,0 +1,71 @@
+// Producer/consumer handoff: one thread allocates and passes blocks through
+// a ring to another thread, which frees them, so every free is remote
+#include <pthread.h>
+#include <sched.h>
+
+#include "bench.h"
+
+#define RING_SIZE 1024
+
+typedef struct Ring {
+    void *slots[RING_SIZE];
+    size_t head;
+    size_t tail;
+} Ring;
+
+static Ring ring;
+static size_t total_items;
+static BenchLatency producer_latency;
+static BenchLatency consumer_latency;
+
+static void *producer(void *arg) {
+    uint64_t rng = *(uint64_t *)arg;
+
+    for (size_t i = 0; i < total_items; i++) {
+        size_t size = bench_random_size(&rng, 16, 4096);
+
+        uint64_t t0 = bench_now();
+        void *ptr = malloc(size);
+        bench_record(&producer_latency, bench_now() - t0);
+        ((char *)ptr)[0] = (char)i;
+
+        while (i - __atomic_load_n(&ring.tail, __ATOMIC_ACQUIRE) >= RING_SIZE) sched_yield();
+        ring.slots[i % RING_SIZE] = ptr;
+        __atomic_store_n(&ring.head, i + 1, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+static void *consumer(void *arg) {
+    (void)arg;
+
+    for (size_t i = 0; i < total_items; i++) {
+        while (__atomic_load_n(&ring.head, __ATOMIC_ACQUIRE) <= i) sched_yield();
+        void *ptr = ring.slots[i % RING_SIZE];
+        __atomic_store_n(&ring.tail, i + 1, __ATOMIC_RELEASE);
+
+        uint64_t t0 = bench_now();
+        free(ptr);
+        bench_record(&consumer_latency, bench_now() - t0);
+    }
+    return NULL;
+}
+
+int main(int argc, char **argv) {
+    Bench bench;
+    pthread_t threads[2];
+
+    bench_init(&bench, argc, argv);
+    total_items = 1000000 * bench.scale;
+
+    uint64_t start = bench_now();
+    pthread_create(&threads[0], NULL, producer, &bench.rng);
+    pthread_create(&threads[1], NULL, consumer, NULL);
+    pthread_join(threads[0], NULL);
+    pthread_join(threads[1], NULL);
+    uint64_t elapsed = bench_now() - start;
+
+    bench_merge(&producer_latency, &consumer_latency);
+    bench_report(&bench, "handoff-16-4096", &producer_latency, elapsed);
+    return 0;
+}
@@ -0,0 +1,46 @@
+// Nearly full heap: tens of thousands of live SMALL blocks with a few holes
+// punched at random, then each step frees one block and asks for a size
+// unrelated to it, so the allocator has to find a hole that fits among
+// many that do not. Sizes stay above the thread cache, which would answer
+// from its bins otherwise.
+#include "bench.h"
+
+#define SLOTS 32768
+#define MIN_SIZE 320
+#define MAX_SIZE 3072
+
+static void *slots[SLOTS];
+
+int main(int argc, char **argv) {
+    Bench bench;
+    BenchLatency latency;
+
+    bench_init(&bench, argc, argv);
+    memset(&latency, 0, sizeof(latency));
+
+    for (size_t slot = 0; slot < SLOTS; slot++) {
+        slots[slot] = malloc(bench_random_size(&bench.rng, MIN_SIZE, MAX_SIZE));
+    }
+    for (size_t slot = 0; slot < SLOTS; slot += 16) {
+        size_t hole = slot + bench_random(&bench.rng) % 16;
+        free(slots[hole]);
+        slots[hole] = NULL;
+    }
+
+    size_t steps = 200000 * bench.scale;
+    uint64_t start = bench_now();
+    for (size_t step = 0; step < steps; step++) {
+        size_t slot = bench_random(&bench.rng) % SLOTS;
+        size_t size = bench_random_size(&bench.rng, MIN_SIZE, MAX_SIZE);
+
+        free(slots[slot]);
+        uint64_t t0 = bench_now();
+        slots[slot] = malloc(size);
+        bench_record(&latency, bench_now() - t0);
+    }
+    uint64_t elapsed = bench_now() - start;
+
+    for (int i = 0; i < SLOTS; i++) free(slots[i]);
+    bench_report(&bench, "nearly-full", &latency, elapsed);
+    return 0;
+}
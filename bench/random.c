@@ -0,0 +1,38 @@
+// Random sizes: a window of live blocks whose sizes follow a log-uniform
+// spread from 8 bytes to 32 KB, so all three classes are exercised
+#include "bench.h"
+
+#define WINDOW 2048
+
+static void *slots[WINDOW];
+
+int main(int argc, char **argv) {
+    Bench bench;
+    BenchLatency latency;
+
+    bench_init(&bench, argc, argv);
+    memset(&latency, 0, sizeof(latency));
+
+    size_t steps = 200000 * bench.scale;
+    uint64_t start = bench_now();
+    for (size_t step = 0; step < steps; step++) {
+        size_t slot = bench_random(&bench.rng) % WINDOW;
+        size_t size = bench_random_size(&bench.rng, 8, 32768);
+
+        void *old = slots[slot];
+        uint64_t t0 = bench_now();
+        free(old);
+        uint64_t t1 = bench_now();
+        slots[slot] = malloc(size);
+        uint64_t t2 = bench_now();
+
+        ((char *)slots[slot])[size - 1] = (char)step;
+        if (old) bench_record(&latency, t1 - t0);
+        bench_record(&latency, t2 - t1);
+    }
+    uint64_t elapsed = bench_now() - start;
+
+    for (int i = 0; i < WINDOW; i++) free(slots[i]);
+    bench_report(&bench, "random-8-32768", &latency, elapsed);
+    return 0;
+}
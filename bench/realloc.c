@@ -0,0 +1,43 @@
+// Realloc growth: buffers grown step by step from a few bytes to 256 KB, the
+// way string builders and vectors grow, with a few buffers live at once
+#include "bench.h"
+
+#define BUFFERS 16
+#define MAX_SIZE (256 * 1024)
+
+static void *buffers[BUFFERS];
+static size_t sizes[BUFFERS];
+
+int main(int argc, char **argv) {
+    Bench bench;
+    BenchLatency latency;
+
+    bench_init(&bench, argc, argv);
+    memset(&latency, 0, sizeof(latency));
+
+    size_t steps = 100000 * bench.scale;
+    uint64_t start = bench_now();
+    for (size_t step = 0; step < steps; step++) {
+        size_t slot = bench_random(&bench.rng) % BUFFERS;
+        size_t size = sizes[slot] + 16 + sizes[slot] / 8;
+
+        if (size > MAX_SIZE) {
+            free(buffers[slot]);
+            buffers[slot] = NULL;
+            size = 16;
+        }
+
+        uint64_t t0 = bench_now();
+        void *ptr = realloc(buffers[slot], size);
+        bench_record(&latency, bench_now() - t0);
+
+        ((char *)ptr)[size - 1] = (char)step;
+        buffers[slot] = ptr;
+        sizes[slot] = size;
+    }
+    uint64_t elapsed = bench_now() - start;
+
+    for (int i = 0; i < BUFFERS; i++) free(buffers[i]);
+    bench_report(&bench, "realloc-growth", &latency, elapsed);
+    return 0;
+}
@@ -0,0 +1,44 @@
+// cache-scratch: the main thread allocates one small object per worker, so
+// they are likely neighbours, and each worker frees its object before
+// running the cache-thrash loop. An allocator that reuses the freed object
+// for that thread inherits the false sharing (passive false sharing).
+#include "../bench.h"
+
+#define OBJECT_SIZE 8
+#define WRITES 1000
+
+static size_t total_iterations;
+
+static void *run(void *arg) {
+    BenchWorker *worker = arg;
+    void **initial = worker->data;
+
+    free(initial[worker->id]);
+    for (size_t i = 0; i < total_iterations / (size_t)worker->threads; i++) {
+        volatile char *object = malloc(OBJECT_SIZE);
+
+        for (int write = 0; write < WRITES; write++) {
+            for (int byte = 0; byte < OBJECT_SIZE; byte++) object[byte]++;
+        }
+        free((void *)object);
+        worker->ops += 2;
+    }
+    return NULL;
+}
+
+int main(int argc, char **argv) {
+    static BenchWorker workers[BENCH_MAX_THREADS];
+    static void *initial[BENCH_MAX_THREADS];
+    Bench bench;
+
+    bench_init(&bench, argc, argv);
+    total_iterations = 20000 * bench.scale;
+
+    for (int threads = 1; threads; threads = bench_next_threads(&bench, threads)) {
+        for (int i = 0; i < threads; i++) initial[i] = malloc(OBJECT_SIZE);
+
+        uint64_t elapsed = bench_run_workers(&bench, threads, run, workers, initial);
+        bench_csv(&bench, "cache-scratch", threads, bench_total_ops(workers, threads), elapsed);
+    }
+    return 0;
+}
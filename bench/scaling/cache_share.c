@@ -0,0 +1,54 @@
+// cache-share: the threads take turns allocating small objects of mixed
+// sizes, so an allocator that carves them from one shared free list
+// interleaves them, then each thread writes its own objects over and over.
+// Objects of different threads on the same cache line make those writes
+// bounce the line between cores (active false sharing).
+#include <sched.h>
+
+#include "../bench.h"
+
+#define OBJECTS 64
+#define WRITES 2000
+
+static size_t rounds;
+static volatile size_t turn;
+
+static void *run(void *arg) {
+    BenchWorker *worker = arg;
+    volatile char *objects[OBJECTS];
+    size_t sizes[OBJECTS];
+
+    for (size_t round = 0; round < rounds; round++) {
+        for (int i = 0; i < OBJECTS; i++) {
+            while (__atomic_load_n(&turn, __ATOMIC_ACQUIRE) % (size_t)worker->threads != (size_t)worker->id) {
+                sched_yield();
+            }
+            sizes[i] = bench_random_size(&worker->rng, 8, 48);
+            objects[i] = malloc(sizes[i]);
+            __atomic_store_n(&turn, turn + 1, __ATOMIC_RELEASE);
+        }
+
+        for (int write = 0; write < WRITES; write++) {
+            for (int i = 0; i < OBJECTS; i++) objects[i][sizes[i] - 1]++;
+        }
+        worker->ops += (uint64_t)WRITES * OBJECTS;
+
+        for (int i = 0; i < OBJECTS; i++) free((void *)objects[i]);
+    }
+    return NULL;
+}
+
+int main(int argc, char **argv) {
+    static BenchWorker workers[BENCH_MAX_THREADS];
+    Bench bench;
+
+    bench_init(&bench, argc, argv);
+    rounds = 20 * bench.scale;
+
+    for (int threads = 1; threads; threads = bench_next_threads(&bench, threads)) {
+        turn = 0;
+        uint64_t elapsed = bench_run_workers(&bench, threads, run, workers, NULL);
+        bench_csv(&bench, "cache-share", threads, bench_total_ops(workers, threads), elapsed);
+    }
+    return 0;
+}
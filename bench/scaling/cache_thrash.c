@@ -0,0 +1,38 @@
+// cache-thrash: each thread repeatedly allocates a small object, writes it
+// many times and frees it. An allocator that hands neighbouring objects to
+// different threads causes active false sharing and this stops scaling.
+#include "../bench.h"
+
+#define OBJECT_SIZE 8
+#define WRITES 1000
+
+static size_t total_iterations;
+
+static void *run(void *arg) {
+    BenchWorker *worker = arg;
+
+    for (size_t i = 0; i < total_iterations / (size_t)worker->threads; i++) {
+        volatile char *object = malloc(OBJECT_SIZE);
+
+        for (int write = 0; write < WRITES; write++) {
+            for (int byte = 0; byte < OBJECT_SIZE; byte++) object[byte]++;
+        }
+        free((void *)object);
+        worker->ops += 2;
+    }
+    return NULL;
+}
+
+int main(int argc, char **argv) {
+    static BenchWorker workers[BENCH_MAX_THREADS];
+    Bench bench;
+
+    bench_init(&bench, argc, argv);
+    total_iterations = 20000 * bench.scale;
+
+    for (int threads = 1; threads; threads = bench_next_threads(&bench, threads)) {
+        uint64_t elapsed = bench_run_workers(&bench, threads, run, workers, NULL);
+        bench_csv(&bench, "cache-thrash", threads, bench_total_ops(workers, threads), elapsed);
+    }
+    return 0;
+}
@@ -0,0 +1,53 @@
+// larson: server-style churn. Each thread replaces random slots of its own
+// share of a table with objects of random size, then exits; the next
+// generation of threads takes over shifted shares, so blocks allocated by
+// a dead thread are freed by a live one.
+#include "../bench.h"
+
+#define SLOTS_PER_THREAD 1000
+#define GENERATIONS 8
+
+static void *table[BENCH_MAX_THREADS * SLOTS_PER_THREAD];
+static size_t steps_per_thread;
+static int generation;
+
+static void *run(void *arg) {
+    BenchWorker *worker = arg;
+    int share = (worker->id + generation) % worker->threads;
+    void **slots = &table[share * SLOTS_PER_THREAD];
+
+    for (size_t step = 0; step < steps_per_thread; step++) {
+        size_t slot = bench_random(&worker->rng) % SLOTS_PER_THREAD;
+        size_t size = 16 + bench_random(&worker->rng) % 1009;
+
+        free(slots[slot]);
+        slots[slot] = malloc(size);
+        ((char *)slots[slot])[0] = (char)step;
+        worker->ops += 2;
+    }
+    return NULL;
+}
+
+int main(int argc, char **argv) {
+    static BenchWorker workers[BENCH_MAX_THREADS];
+    Bench bench;
+
+    bench_init(&bench, argc, argv);
+
+    for (int threads = 1; threads; threads = bench_next_threads(&bench, threads)) {
+        uint64_t ops = 0, elapsed = 0;
+
+        steps_per_thread = 200000 * bench.scale / (size_t)threads / GENERATIONS;
+        for (generation = 0; generation < GENERATIONS; generation++) {
+            elapsed += bench_run_workers(&bench, threads, run, workers, NULL);
+            ops += bench_total_ops(workers, threads);
+        }
+        bench_csv(&bench, "larson", threads, ops, elapsed);
+
+        for (int i = 0; i < threads * SLOTS_PER_THREAD; i++) {
+            free(table[i]);
+            table[i] = NULL;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,38 @@
+// threadtest: each thread allocates a batch of small objects and frees it
+// again, with a fixed total amount of work split across the threads. With
+// no sharing at all, throughput should scale with the thread count.
+#include "../bench.h"
+
+#define BATCH 1000
+#define OBJECT_SIZE 64
+
+static size_t total_rounds;
+
+static void *run(void *arg) {
+    BenchWorker *worker = arg;
+    void *batch[BATCH];
+
+    for (size_t round = 0; round < total_rounds / (size_t)worker->threads; round++) {
+        for (int i = 0; i < BATCH; i++) {
+            batch[i] = malloc(OBJECT_SIZE);
+            ((char *)batch[i])[0] = (char)i;
+        }
+        for (int i = 0; i < BATCH; i++) free(batch[i]);
+        worker->ops += 2 * BATCH;
+    }
+    return NULL;
+}
+
+int main(int argc, char **argv) {
+    static BenchWorker workers[BENCH_MAX_THREADS];
+    Bench bench;
+
+    bench_init(&bench, argc, argv);
+    total_rounds = 2000 * bench.scale;
+
+    for (int threads = 1; threads; threads = bench_next_threads(&bench, threads)) {
+        uint64_t elapsed = bench_run_workers(&bench, threads, run, workers, NULL);
+        bench_csv(&bench, "threadtest", threads, bench_total_ops(workers, threads), elapsed);
+    }
+    return 0;
+}
@@ -0,0 +1,75 @@
+// xmalloc: threads form a ring. Each allocates batches of objects and hands
+// them to the next thread, which frees them, so every free is cross-thread.
+#include <sched.h>
+
+#include "../bench.h"
+
+#define BATCH 256
+
+typedef struct Mailbox {
+    void **batch;
+    char padding[64 - sizeof(void **)];
+} Mailbox;
+
+static Mailbox mailboxes[BENCH_MAX_THREADS];
+static size_t total_batches;
+static int finished;
+
+static void drain(BenchWorker *worker, Mailbox *mailbox) {
+    void **batch = __atomic_exchange_n(&mailbox->batch, NULL, __ATOMIC_ACQUIRE);
+    if (!batch) return;
+
+    for (int i = 0; i < BATCH; i++) free(batch[i]);
+    free(batch);
+    worker->ops += BATCH + 1;
+}
+
+static void *run(void *arg) {
+    BenchWorker *worker = arg;
+    Mailbox *own = &mailboxes[worker->id];
+    Mailbox *next = &mailboxes[(worker->id + 1) % worker->threads];
+
+    for (size_t round = 0; round < total_batches / (size_t)worker->threads; round++) {
+        void **batch = malloc(BATCH * sizeof(void *));
+        for (int i = 0; i < BATCH; i++) {
+            batch[i] = malloc(16 + bench_random(&worker->rng) % 241);
+            ((char *)batch[i])[0] = (char)i;
+        }
+        worker->ops += BATCH + 1;
+
+        void **expected = NULL;
+        while (!__atomic_compare_exchange_n(&next->batch, &expected, batch, false,
+                                            __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+            expected = NULL;
+            drain(worker, own);
+            sched_yield();
+        }
+        drain(worker, own);
+    }
+
+    // Keep taking deliveries until every thread has handed off its last batch
+    __atomic_fetch_add(&finished, 1, __ATOMIC_RELEASE);
+    while (__atomic_load_n(&finished, __ATOMIC_ACQUIRE) < worker->threads) {
+        drain(worker, own);
+        sched_yield();
+    }
+    return NULL;
+}
+
+int main(int argc, char **argv) {
+    static BenchWorker workers[BENCH_MAX_THREADS];
+    Bench bench;
+
+    bench_init(&bench, argc, argv);
+    total_batches = 4000 * bench.scale;
+
+    for (int threads = 1; threads; threads = bench_next_threads(&bench, threads)) {
+        finished = 0;
+        uint64_t elapsed = bench_run_workers(&bench, threads, run, workers, NULL);
+
+        // Batches still in flight when the last thread finished
+        for (int i = 0; i < threads; i++) drain(&workers[i], &mailboxes[i]);
+        bench_csv(&bench, "xmalloc", threads, bench_total_ops(workers, threads), elapsed);
+    }
+    return 0;
+}
@@ -0,0 +1,61 @@
+// Thread churn: short-lived workers, as in a thread pool that keeps
+// replacing its threads, each allocating and freeing small blocks before
+// exiting. Memory a dead thread kept would show up as RSS growth.
+#include "bench.h"
+
+#define WAVE_THREADS 8
+#define BLOCKS_PER_THREAD 256
+
+static BenchLatency latencies[WAVE_THREADS];
+
+static void *worker(void *arg) {
+    BenchWorker *self = arg;
+    BenchLatency *latency = self->data;
+    void *blocks[BLOCKS_PER_THREAD];
+
+    for (int round = 0; round < 4; round++) {
+        for (int i = 0; i < BLOCKS_PER_THREAD; i++) {
+            uint64_t t0 = bench_now();
+            blocks[i] = malloc(bench_random_size(&self->rng, 16, 256));
+            bench_record(latency, bench_now() - t0);
+            ((char *)blocks[i])[0] = (char)i;
+        }
+        for (int i = 0; i < BLOCKS_PER_THREAD; i++) {
+            uint64_t t0 = bench_now();
+            free(blocks[i]);
+            bench_record(latency, bench_now() - t0);
+        }
+    }
+    return NULL;
+}
+
+static void *start_worker(void *arg) {
+    BenchWorker *self = arg;
+    self->data = &latencies[self->id];
+    return worker(self);
+}
+
+int main(int argc, char **argv) {
+    Bench bench;
+    BenchWorker workers[WAVE_THREADS];
+    BenchLatency latency;
+
+    bench_init(&bench, argc, argv);
+    memset(&latency, 0, sizeof(latency));
+    size_t waves = 10000 * bench.scale / WAVE_THREADS;
+
+    // The first half warms up the zones and touches their pages; the second
+    // half should reuse them without growing
+    uint64_t elapsed = 0;
+    long halfway = 0;
+    for (size_t wave = 0; wave < waves; wave++) {
+        elapsed += bench_run_workers(&bench, WAVE_THREADS, start_worker, workers, NULL);
+        if (wave == waves / 2) halfway = bench_rss_kb();
+    }
+    for (int i = 0; i < WAVE_THREADS; i++) bench_merge(&latency, &latencies[i]);
+
+    bench_report(&bench, "thread-churn-10000", &latency, elapsed);
+    printf("%-22s %-10s RSS after %zu threads %ld KB, after %zu threads %ld KB\n", "thread-churn-10000",
+           bench.allocator, waves / 2 * WAVE_THREADS, halfway, waves * WAVE_THREADS, bench_rss_kb());
+    return 0;
+}
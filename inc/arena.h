@@ -0,0 +1,51 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define ARENA_ALIGNMENT 16
+
+// Zone payload an arena maps at a time unless arena_create() asks otherwise
+#define ARENA_ZONE_SIZE (64 * 1024)
+
+// Zones of destroyed arenas kept for the next arenas instead of unmapped,
+// until malloc_trim()
+#define ARENA_RECYCLE_MAX 64
+
+// Arenas that can be named by index in mallocx() flags at any one time
+#define ARENA_INDEX_MAX 256
+
+// A bump allocator over a chain of zones. The Arena lives at the start of
+// its first zone, which it keeps until destroyed; later zones go to spare on
+// reset and are reused before anything new is mapped. An arena is not
+// thread-safe, and its memory must never be passed to free() or realloc().
+// index is -1 when every index was taken at creation.
+typedef struct __attribute__((aligned(ARENA_ALIGNMENT))) Arena {
+  char *cursor;
+  char *end;
+  struct Zone *zones;
+  struct Zone *spare;
+  struct Zone *home;
+  size_t zone_size;
+  int index;
+} Arena;
+
+// Exported, since arena_alloc() is inlined into callers
+FT_MALLOC_API void *arena_alloc_slow(Arena *arena, size_t size);
+FT_MALLOC_API void *arena_alloc_aligned(Arena *arena, size_t size, size_t alignment);
+
+static inline void *arena_alloc(Arena *arena, size_t size) {
+  size_t rounded = (size + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+
+  // rounded - 1 wraps for 0 and for sizes whose rounding overflowed, which
+  // the slow path rejects
+  if (rounded - 1 < (size_t)(arena->end - arena->cursor)) {
+    void *result = arena->cursor;
+    arena->cursor += rounded;
+    return result;
+  }
+  return arena_alloc_slow(arena, size);
+}
+
+#endif
@@ -0,0 +1,52 @@
+#ifndef BITMAP_H
+#define BITMAP_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Bitmaps are arrays of 64-bit words, bit i living in word i / 64
+static inline void bitmap_set(uint64_t *words, int bit) {
+  words[bit >> 6] |= (uint64_t)1 << (bit & 63);
+}
+
+static inline void bitmap_clear(uint64_t *words, int bit) {
+  words[bit >> 6] &= ~((uint64_t)1 << (bit & 63));
+}
+
+static inline bool bitmap_test(const uint64_t *words, int bit) {
+  return (words[bit >> 6] >> (bit & 63)) & 1;
+}
+
+// Index of the first set bit at or after from, or -1. The word holding from
+// is masked and scanned with tzcnt; the words after it are compared against
+// zero two at a time with SSE2. The bin map is only a few words long, so
+// AVX2 would need a CPUID dispatch that costs more than it saves.
+static inline int bitmap_first_set(const uint64_t *words, int word_count, int from) {
+  int index = from >> 6;
+  if (index >= word_count) return -1;
+
+  uint64_t word = words[index] & (~(uint64_t)0 << (from & 63));
+  if (word) return (index << 6) + __builtin_ctzll(word);
+  index++;
+
+#if defined(__SSE2__)
+  for (; index + 2 <= word_count; index += 2) {
+    __m128i vector = _mm_loadu_si128((const __m128i *)(words + index));
+    int zero = _mm_movemask_epi8(_mm_cmpeq_epi8(vector, _mm_setzero_si128()));
+    if (zero == 0xFFFF) continue;
+
+    int lane = ((zero & 0xFF) == 0xFF) ? 1 : 0;
+    return ((index + lane) << 6) + __builtin_ctzll(words[index + lane]);
+  }
+#endif
+  for (; index < word_count; index++) {
+    if (words[index]) return (index << 6) + __builtin_ctzll(words[index]);
+  }
+  return -1;
+}
+
+#endif
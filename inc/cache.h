@@ -0,0 +1,51 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// One bin per TINY block size, from the smallest block (64 bytes) to
+// TINY_BLOCK_MAX_SIZE in ALIGNMENT steps; the last bin also takes the
+// unsplit blocks that are a little larger
+#define CACHE_BINS 13
+#define CACHE_BIN_MAX 32
+
+// TINY allocations the bins cannot serve are carved from a run of this many
+// bytes the thread takes from the heap, cache line aligned at both ends, so
+// blocks a thread allocates never share a line with another thread's
+#define CACHE_RUN_SIZE 2048
+
+struct Block;
+
+// Freed TINY blocks a thread keeps for its next allocations of the same
+// size. Only its thread touches the bins. run is what is left of its
+// current run, a CACHED block carved from under the TINY lock, since
+// splitting it updates its neighbour. allocations and bytes count the
+// blocks it has handed out since its deltas were last folded into the TINY
+// stats, and are read by malloc_get_stats() from other threads.
+typedef struct ThreadCache {
+  struct ThreadCache *next;
+  struct ThreadCache *prev;
+  struct Block *bins[CACHE_BINS];
+  uint32_t counts[CACHE_BINS];
+  struct Block *run;
+  size_t allocations;
+  size_t bytes;
+} ThreadCache;
+
+extern __thread ThreadCache *thread_cache __attribute__((tls_model("initial-exec")));
+
+void cache_init(void);
+void cache_disable(void);
+ThreadCache *cache_create(void);
+void cache_flush(ThreadCache *cache);
+void cache_pending(size_t *allocations, size_t *bytes);
+
+// NULL when caching is disabled, or once the thread has started exiting
+static inline ThreadCache *cache_get(void) {
+  ThreadCache *cache = thread_cache;
+  return cache ? cache : cache_create();
+}
+
+#endif
@@ -0,0 +1,30 @@
+#ifndef COPY_H
+#define COPY_H
+
+#include <stddef.h>
+
+// Copies and fills of at least this many bytes use non-temporal stores, so
+// moving a large block does not evict the whole cache. It is raised at load
+// time to the size of a core's L2 cache when that is larger: a copy that
+// does not fit there would evict it anyway.
+#define COPY_STREAM_MIN (1024 * 1024)
+
+typedef void *(*CopyKernel)(void *dst, const void *src, size_t size);
+typedef void *(*FillKernel)(void *dst, int value, size_t size);
+
+// Selected once at load time from CPUID; until then, and on targets without
+// a vector kernel, they point at the widest version the build guarantees
+extern CopyKernel copy_kernel;
+extern FillKernel fill_kernel;
+extern size_t copy_stream_threshold;
+
+// Neither accepts overlapping buffers
+static inline void *copy_bytes(void *dst, const void *src, size_t size) {
+  return copy_kernel(dst, src, size);
+}
+
+static inline void *fill_bytes(void *dst, int value, size_t size) {
+  return fill_kernel(dst, value, size);
+}
+
+#endif
@@ -0,0 +1,150 @@
+#ifndef INTERNAL_H
+#define INTERNAL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "lock.h"
+#include "malloc.h"
+
+// Layout of the heaps and helpers shared between the library's translation
+// units. None of it is part of the API, so it stays out of malloc.h and out
+// of the .so's dynamic symbol table.
+#define INTERNAL __attribute__((visibility("hidden")))
+
+#ifndef MALLOC_CHECK
+#define MALLOC_CHECK 0
+#endif
+#ifndef MALLOC_PERTURB
+#define MALLOC_PERTURB 0
+#endif
+
+#define ALIGNMENT 16
+
+#define TINY_BLOCK_MAX_SIZE 256
+#define SMALL_BLOCK_MAX_SIZE 4096
+
+#define TINY_ZONE_SIZE TINY_BLOCK_MAX_SIZE * 512
+#define SMALL_ZONE_SIZE SMALL_BLOCK_MAX_SIZE * 128
+
+// Each new zone of a class doubles in size, up to 1 << ZONE_GROWTH_MAX_SHIFT
+// times the base size
+#define ZONE_GROWTH_MAX_SHIFT 6
+
+// The first block of a TINY/SMALL zone starts 0 to ZONE_COLORS - 1 cache
+// lines into the zone depending on the zone, so the first blocks of zones,
+// which are all page aligned, do not compete for the same cache sets
+#define CACHE_LINE_SIZE 64
+#define ZONE_COLORS 8
+
+void abort(void) __attribute__((noreturn));
+
+// CACHED blocks are free but held in a thread's cache or a heap's fast
+// bins: they are in no free list and are never coalesced. A thread cache
+// hands its blocks out again without the lock, so their headers stay
+// CACHED, and heap walks count them as cached until they are freed.
+typedef enum { FREE, ALLOCATED, FREED, CACHED } BlockStatus;
+
+#define BLOCK_SAMPLED 0x1
+
+// Purge state of free blocks: AGED blocks were already free at the last
+// purger pass, PURGED blocks have had their pages returned since they were
+// freed. A merge keeps a flag only if both sides had it.
+#define BLOCK_AGED 0x2
+#define BLOCK_PURGED 0x4
+#define BLOCK_PURGE_FLAGS (BLOCK_AGED | BLOCK_PURGED)
+
+// Block headers sit inline, right before their payload: coalescing,
+// resizing, the bins and the report walks all rely on that. An overrun of
+// one block therefore still lands in the header of the next.
+// slack is the payload an allocated block holds beyond the requested size,
+// saturating at UINT16_MAX; it fits in what was header padding
+typedef struct __attribute__((aligned(ALIGNMENT))) Block {
+  BlockStatus status;
+  uint16_t flags;
+  uint16_t slack;
+  size_t size;
+  struct Block *prev;
+  struct Block *next;
+  struct Block *free_prev;
+  struct Block *free_next;
+} Block;
+
+// Zone descriptors live out of band, one cache line each in metadata pages
+// of their own (see metadata.c), so walking the zone list or checking
+// whether a zone is empty does not touch user pages, and an overrun inside
+// a zone cannot reach its descriptor. Walking a zone's blocks still reads
+// the inline block headers. base is the zone's mapping, offset where its
+// first block starts in it, and live the number of its blocks that are not
+// FREE.
+typedef struct __attribute__((aligned(CACHE_LINE_SIZE))) Zone {
+  char *base;
+  size_t size;
+  ZoneType type;
+  uint32_t offset;
+  size_t live;
+  Block *blocks;
+  struct Zone *prev;
+  struct Zone *next;
+} Zone;
+
+// Free blocks are binned by size across all zones of a class: one bin per
+// ALIGNMENT step below BIN_EXACT_LIMIT, then four per power of two.
+// bin_map has a bit set for every non-empty bin.
+#define BIN_EXACT_SHIFT 12
+#define BIN_EXACT_LIMIT ((size_t)1 << BIN_EXACT_SHIFT)
+#define BIN_EXACT_COUNT (BIN_EXACT_LIMIT / ALIGNMENT)
+#define HEAP_BIN_WORDS 8
+#define HEAP_BINS (HEAP_BIN_WORDS * 64)
+
+// Freed TINY/SMALL blocks below BIN_EXACT_LIMIT wait in a fast bin of their
+// exact size, unmerged, for the next request of that size. They are merged
+// back all at once when a request finds no other block, when a heap's fast
+// bins hold more than FAST_BIN_MAX_BYTES, on purges and on cache flushes.
+#define FAST_BINS BIN_EXACT_COUNT
+#define FAST_BIN_WORDS (FAST_BINS / 64)
+#define FAST_BIN_MAX_BYTES (64 * 1024)
+
+typedef struct Heap {
+  Lock lock;
+  ClassStats stats;
+  ZoneType type;
+  size_t zone_size;
+  size_t zone_count;
+  Zone *zones;
+  Block *bins[HEAP_BINS];
+  uint64_t bin_map[HEAP_BIN_WORDS];
+  Block *fast[FAST_BINS];
+  uint64_t fast_map[FAST_BIN_WORDS];
+  size_t fast_bytes;
+  Zone *spare;
+  uint32_t color;
+  bool ready;
+  bool realtime;
+} Heap;
+
+// Metadata copied out of the heaps, already laid out as in the file. It
+// lives in its own mapping so taking a snapshot never allocates.
+typedef struct SnapshotBuffer {
+  char *data;
+  size_t length;
+  size_t capacity;
+  size_t zones;
+  size_t blocks;
+  size_t content_bytes;
+  bool failed;
+} SnapshotBuffer;
+
+INTERNAL void *snapshot_reserve(SnapshotBuffer *buffer, size_t size);
+INTERNAL size_t purge_heaps(size_t pad, bool decay);
+INTERNAL bool reserve_heap(ZoneType type, size_t size, bool lock_pages);
+INTERNAL void snapshot_heap(ZoneType type, SnapshotBuffer *buffer);
+INTERNAL Zone *map_zone_memory(ZoneType type, size_t size);
+INTERNAL void unmap_zone(Zone *zone);
+INTERNAL Zone *zone_descriptor_alloc(void);
+INTERNAL void zone_descriptor_free(Zone *zone);
+INTERNAL void *arena_alloc_indexed(unsigned index, size_t size, size_t alignment, bool zero);
+INTERNAL size_t arena_trim(void);
+
+#endif
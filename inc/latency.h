@@ -0,0 +1,40 @@
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "malloc.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// Build with -DMALLOC_LATENCY=1 to time allocator operations; otherwise
+// every hook below folds away to nothing
+#ifndef MALLOC_LATENCY
+#define MALLOC_LATENCY 0
+#endif
+
+void latency_add(LatencyOp op, int type, uint64_t ticks);
+
+static inline uint64_t latency_ticks(void) {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+#endif
+}
+
+static inline uint64_t latency_start(void) {
+  return MALLOC_LATENCY ? latency_ticks() : 0;
+}
+
+static inline void latency_record(LatencyOp op, int type, uint64_t start) {
+  if (MALLOC_LATENCY) latency_add(op, type, latency_ticks() - start);
+}
+
+#endif
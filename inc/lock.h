@@ -0,0 +1,54 @@
+#ifndef LOCK_H
+#define LOCK_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "malloc.h"
+
+// Spin rounds before a waiter parks; each round pauses twice as long as the
+// previous one, up to LOCK_BACKOFF_MAX pause instructions
+#define LOCK_SPIN_LIMIT 10
+#define LOCK_BACKOFF_MAX 64
+
+typedef enum { UNLOCKED, LOCKED, CONTENDED } LockState;
+
+// A spin_only lock never parks its waiters, so neither taking nor releasing
+// it makes a syscall. parked counts the waiters between deciding to park and
+// giving up on it. The counters live on their own cache line so a waiter
+// counting contention does not steal the line the holder releases.
+typedef struct __attribute__((aligned(64))) Lock {
+  uint32_t state;
+  uint32_t spin_only;
+  uint32_t parked;
+  LockStats stats __attribute__((aligned(64)));
+} Lock;
+
+#define LOCK_INITIALIZER {UNLOCKED, 0, 0, {0, 0, 0, 0}}
+
+void lock_acquire_slow(Lock *lock);
+void lock_wake(Lock *lock);
+void lock_set_spin_only(Lock *lock);
+void lock_get_stats(Lock *lock, LockStats *stats);
+
+static inline bool lock_try_acquire(Lock *lock) {
+  uint32_t expected = UNLOCKED;
+  return __atomic_compare_exchange_n(&lock->state, &expected, LOCKED, false,
+                                     __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+// Only the holder bumps the acquisition count, so it needs no atomic RMW
+static inline void lock_acquire(Lock *lock) {
+  if (!lock_try_acquire(lock)) lock_acquire_slow(lock);
+  size_t acquisitions = __atomic_load_n(&lock->stats.acquisitions, __ATOMIC_RELAXED);
+  __atomic_store_n(&lock->stats.acquisitions, acquisitions + 1, __ATOMIC_RELAXED);
+}
+
+static inline void lock_release(Lock *lock) {
+  if (__atomic_exchange_n(&lock->state, UNLOCKED, __ATOMIC_RELEASE) == CONTENDED) {
+    lock_wake(lock);
+  }
+}
+
+#endif
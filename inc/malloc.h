@@ -1,59 +1,150 @@
 #ifndef MALLOC_H
 #define MALLOC_H
 
-#include <errno.h>
-#include <pthread.h>
 #include <stdbool.h>
-#include <stdio.h>
-#include <string.h>
-#include <sys/mman.h>
-#include <sys/resource.h>
-#include <unistd.h>
+#include <stddef.h>
+#include <stdint.h>
 
-#include "libft.h"
+// The library is built with -fvisibility=hidden, so only what is declared
+// with FT_MALLOC_API, here and in the headers below, is exported
+#define FT_MALLOC_API __attribute__((visibility("default")))
 
-#ifndef MALLOC_CHECK
-#define MALLOC_CHECK 0
-#endif
-#ifndef MALLOC_PERTURB
-#define MALLOC_PERTURB 0
-#endif
+#include "arena.h"
+#include "mallocx.h"
+#include "snapshot.h"
+
+// malloc_reserve() flag: lock the reserved pages in memory
+#define MALLOC_RESERVE_LOCK 0x1
+
+// ARENA zones belong to an Arena rather than to a heap
+typedef enum { TINY, SMALL, LARGE, ARENA } ZoneType;
+
+typedef struct LockStats {
+  size_t acquisitions;
+  size_t contended;
+  size_t spins;
+  size_t parks;
+} LockStats;
+
+// Bucket i counts operations that took [2^i, 2^(i+1)) ticks
+#define LATENCY_BUCKETS 48
+
+typedef enum {
+  LATENCY_MALLOC,
+  LATENCY_FREE,
+  LATENCY_REALLOC,
+  LATENCY_MAP,
+  LATENCY_LOCK_WAIT,
+  LATENCY_OPS
+} LatencyOp;
+
+typedef struct LatencyHistogram {
+  size_t count;
+  size_t total;
+  size_t max;
+  size_t buckets[LATENCY_BUCKETS];
+} LatencyHistogram;
+
+// Ticks are TSC cycles on x86 and nanoseconds elsewhere
+typedef struct MallocLatency {
+  const char *unit;
+  LatencyHistogram ops[LATENCY_OPS][3];
+} MallocLatency;
+
+// Per-class counters, kept up to date under the class lock and readable
+// without it. fragmentation is derived when the stats are read: the share
+// of free bytes among the bytes not spent on headers, in thousandths.
+// reserved is what malloc_reserve() mapped for the class, peak the highest
+// in_use seen under the lock, and exhausted counts the allocations a
+// real-time class refused instead of mapping more. The total's peak is the
+// sum of the class peaks.
+typedef struct ClassStats {
+  size_t in_use;
+  size_t free;
+  size_t mapped;
+  size_t zones;
+  size_t allocations;
+  size_t frees;
+  size_t fragmentation;
+  size_t reserved;
+  size_t peak;
+  size_t exhausted;
+} ClassStats;
+
+typedef struct MallocStats {
+  ClassStats classes[3];
+  ClassStats total;
+  LockStats locks[3];
+} MallocStats;
+
+// Free blocks are bucketed by payload in powers of two from 16 bytes, zones
+// by the share of their bytes held by allocated blocks, in tenths
+#define REPORT_SIZE_BUCKETS 16
+#define REPORT_OCCUPANCY_BUCKETS 10
+
+// Heap shape of one class, computed in a single pass over its blocks.
+// in_use - requested is the slack left by align() rounding and unsplit
+// remainders; overhead counts block headers and the bytes zones skip for
+// their color. free and largest_free are whole free extents, headers
+// included. internal and external are derived, in thousandths: the share
+// of bytes spent on allocations that callers did not ask for, and the share
+// of free bytes outside the largest free extent.
+typedef struct ClassReport {
+  size_t zones;
+  size_t mapped;
+  size_t allocated_blocks;
+  size_t free_blocks;
+  size_t requested;
+  size_t in_use;
+  size_t overhead;
+  size_t free;
+  size_t largest_free;
+  size_t internal;
+  size_t external;
+  size_t free_sizes[REPORT_SIZE_BUCKETS];
+  size_t occupancy[REPORT_OCCUPANCY_BUCKETS];
+} ClassReport;
+
+typedef struct HeapReport {
+  ClassReport classes[3];
+} HeapReport;
 
-#define ALIGNMENT 16
-
-#define TINY_BLOCK_MAX_SIZE 256
-#define SMALL_BLOCK_MAX_SIZE 4096
-
-#define TINY_ZONE_SIZE TINY_BLOCK_MAX_SIZE * 512
-#define SMALL_ZONE_SIZE SMALL_BLOCK_MAX_SIZE * 128
-
-void abort(void) __attribute__((noreturn));
-
-typedef enum { TINY, SMALL, LARGE } ZoneType;
-typedef enum { FREE, ALLOCATED, FREED } BlockStatus;
-
-typedef struct __attribute__((aligned(ALIGNMENT))) Block {
-  BlockStatus status;
-  size_t size;
-  struct Block *prev;
-  struct Block *next;
-  struct Block *free_prev;
-  struct Block *free_next;
-} Block;
-
-typedef struct __attribute__((aligned(ALIGNMENT))) Zone {
-  size_t size;
-  ZoneType type;
-  Block *blocks;
-  Block *free_blocks;
-  struct Zone *prev;
-  struct Zone *next;
-} Zone;
-
-void *malloc(size_t size);
-void *realloc(void *ptr, size_t size);
-void free(void *ptr);
-void show_alloc_mem();
-void show_alloc_mem_ex();
+FT_MALLOC_API void *malloc(size_t size);
+FT_MALLOC_API void *calloc(size_t count, size_t size);
+FT_MALLOC_API void *realloc(void *ptr, size_t size);
+FT_MALLOC_API void free(void *ptr);
+FT_MALLOC_API void *aligned_alloc(size_t alignment, size_t size);
+FT_MALLOC_API void *memalign(size_t alignment, size_t size);
+FT_MALLOC_API void *valloc(size_t size);
+FT_MALLOC_API int posix_memalign(void **memptr, size_t alignment, size_t size);
+FT_MALLOC_API void *mallocx(size_t size, int flags);
+FT_MALLOC_API void *rallocx(void *ptr, size_t size, int flags);
+FT_MALLOC_API size_t xallocx(void *ptr, size_t size, size_t extra, int flags);
+FT_MALLOC_API size_t sallocx(const void *ptr, int flags);
+FT_MALLOC_API void dallocx(void *ptr, int flags);
+FT_MALLOC_API size_t nallocx(size_t size, int flags);
+FT_MALLOC_API void malloc_thread_flush(void);
+FT_MALLOC_API size_t malloc_usable_size(void *ptr);
+FT_MALLOC_API bool ft_malloc_owns(const void *ptr);
+FT_MALLOC_API int malloc_trim(size_t pad);
+FT_MALLOC_API void malloc_set_purge_window(size_t milliseconds);
+FT_MALLOC_API int malloc_reserve(size_t tiny, size_t small, size_t large, int flags);
+FT_MALLOC_API void show_alloc_mem();
+FT_MALLOC_API void show_alloc_mem_ex();
+FT_MALLOC_API void malloc_lock_stats(ZoneType type, LockStats *stats);
+FT_MALLOC_API void malloc_get_stats(MallocStats *stats);
+FT_MALLOC_API void malloc_stats(void);
+FT_MALLOC_API void malloc_prof_set_rate(size_t rate);
+FT_MALLOC_API int malloc_prof_dump(int fd);
+FT_MALLOC_API void malloc_get_latency(MallocLatency *latency);
+FT_MALLOC_API size_t malloc_latency_percentile(const LatencyHistogram *histogram, size_t per_mille);
+FT_MALLOC_API void malloc_heap_report(HeapReport *report);
+FT_MALLOC_API void show_alloc_report(void);
+FT_MALLOC_API int malloc_heap_report_json(int fd);
+FT_MALLOC_API int malloc_snapshot(int fd, int flags);
+FT_MALLOC_API Arena *arena_create(size_t zone_size);
+FT_MALLOC_API void arena_reset(Arena *arena);
+FT_MALLOC_API void arena_destroy(Arena *arena);
+FT_MALLOC_API int arena_index(const Arena *arena);
 
 #endif
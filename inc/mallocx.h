@@ -0,0 +1,22 @@
+#ifndef MALLOCX_H
+#define MALLOCX_H
+
+// Flags for the mallocx() family, or'ed together. The low six bits hold
+// the base-2 log of the alignment, 0 for the default ALIGNMENT.
+#define MALLOCX_LG_ALIGN(lg) ((int)(lg))
+#define MALLOCX_ALIGN(alignment) ((int)__builtin_ctzl(alignment))
+#define MALLOCX_LG_ALIGN_MASK 0x3f
+
+// Zero the payload, or the bytes a resize adds to it
+#define MALLOCX_ZERO 0x40
+
+// Neither take the block from nor give it back to the thread's cache
+#define MALLOCX_NO_CACHE 0x80
+
+// Allocate from the arena with that index, see arena_index(). Only
+// mallocx() takes it: arena memory is never resized or freed on its own.
+#define MALLOCX_ARENA(index) ((int)(((unsigned)(index) + 1) << 8))
+#define MALLOCX_ARENA_SHIFT 8
+#define MALLOCX_ARENA_MASK (0x1ff << MALLOCX_ARENA_SHIFT)
+
+#endif
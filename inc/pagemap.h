@@ -0,0 +1,49 @@
+#ifndef PAGEMAP_H
+#define PAGEMAP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Radix tree from 4 KB page number to the heap zone covering that page, for
+// user addresses below 1 << PAGEMAP_ADDRESS_BITS: a static root, then
+// interior nodes and leaves mapped on first use and never freed. A leaf
+// covers 16 MB. Entries are the Zone descriptor address with the zone's
+// type in the low bits, 0 for pages that are not ours.
+#define PAGEMAP_PAGE_SHIFT 12
+#define PAGEMAP_ADDRESS_BITS 47
+#define PAGEMAP_LEAF_BITS 12
+#define PAGEMAP_NODE_BITS 12
+#define PAGEMAP_ROOT_BITS (PAGEMAP_ADDRESS_BITS - PAGEMAP_PAGE_SHIFT - PAGEMAP_NODE_BITS - PAGEMAP_LEAF_BITS)
+
+#define PAGEMAP_TYPE_MASK ((uintptr_t)0x3)
+
+typedef struct PageMapLeaf {
+  uintptr_t entries[1 << PAGEMAP_LEAF_BITS];
+} PageMapLeaf;
+
+typedef struct PageMapNode {
+  PageMapLeaf *leaves[1 << PAGEMAP_NODE_BITS];
+} PageMapNode;
+
+extern PageMapNode *pagemap_root[1 << PAGEMAP_ROOT_BITS];
+
+bool pagemap_set(const void *start, size_t size, uintptr_t entry);
+
+// Lock-free; an entry only stays current while its class lock is held
+static inline uintptr_t pagemap_get(const void *ptr) {
+  uintptr_t page = (uintptr_t)ptr >> PAGEMAP_PAGE_SHIFT;
+  if (page >> (PAGEMAP_ROOT_BITS + PAGEMAP_NODE_BITS + PAGEMAP_LEAF_BITS)) return 0;
+
+  PageMapNode *node = __atomic_load_n(&pagemap_root[page >> (PAGEMAP_NODE_BITS + PAGEMAP_LEAF_BITS)],
+                                      __ATOMIC_ACQUIRE);
+  if (!node) return 0;
+
+  PageMapLeaf *leaf = __atomic_load_n(&node->leaves[(page >> PAGEMAP_LEAF_BITS) & ((1 << PAGEMAP_NODE_BITS) - 1)],
+                                      __ATOMIC_ACQUIRE);
+  if (!leaf) return 0;
+
+  return __atomic_load_n(&leaf->entries[page & ((1 << PAGEMAP_LEAF_BITS) - 1)], __ATOMIC_RELAXED);
+}
+
+#endif
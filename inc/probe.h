@@ -0,0 +1,82 @@
+#ifndef PROBE_H
+#define PROBE_H
+
+#include <stdint.h>
+
+// Static tracepoints for bpftrace, perf and systemtap, under the provider
+// ft_malloc (e.g. `bpftrace -e 'usdt:./libft_malloc.so:ft_malloc:zone_map'`).
+// A probe site is a single nop plus an ELF note naming it and describing
+// where its arguments live; tracers patch the nop when they attach, so an
+// unattached probe costs one instruction. Arguments are passed as 8-byte
+// integers. Build with -DMALLOC_PROBES=0 to compile the sites out entirely.
+#ifndef MALLOC_PROBES
+#define MALLOC_PROBES 1
+#endif
+
+#if MALLOC_PROBES && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define PROBE_SDT 1
+#endif
+#endif
+
+#define PROBE_ARG(a) ((int64_t)(intptr_t)(a))
+
+#if MALLOC_PROBES && defined(PROBE_SDT)
+
+#define PROBE_NOTES 1
+#define PROBE0(name) DTRACE_PROBE(ft_malloc, name)
+#define PROBE1(name, a) DTRACE_PROBE1(ft_malloc, name, PROBE_ARG(a))
+#define PROBE2(name, a, b) DTRACE_PROBE2(ft_malloc, name, PROBE_ARG(a), PROBE_ARG(b))
+#define PROBE3(name, a, b, c) DTRACE_PROBE3(ft_malloc, name, PROBE_ARG(a), PROBE_ARG(b), PROBE_ARG(c))
+
+#elif MALLOC_PROBES && defined(__ELF__) && (defined(__x86_64__) || defined(__aarch64__))
+
+// Without <sys/sdt.h>, the same .note.stapsdt layout is emitted by hand:
+// probe address, .stapsdt.base address (lets tracers account for
+// prelinking), semaphore address (none), then provider, name and argument
+// descriptions as strings
+#define PROBE_NOTE(name, arguments)                                    \
+  "990: nop\n"                                                         \
+  ".pushsection .note.stapsdt,\"?\",\"note\"\n"                        \
+  ".balign 4\n"                                                        \
+  ".4byte 992f-991f, 994f-993f, 3\n"                                   \
+  "991: .asciz \"stapsdt\"\n"                                          \
+  "992: .balign 4\n"                                                   \
+  "993: .8byte 990b\n"                                                 \
+  ".8byte _.stapsdt.base\n"                                            \
+  ".8byte 0\n"                                                         \
+  ".asciz \"ft_malloc\"\n"                                             \
+  ".asciz \"" #name "\"\n"                                             \
+  ".asciz \"" arguments "\"\n"                                         \
+  "994: .balign 4\n"                                                   \
+  ".popsection\n"                                                      \
+  ".ifndef _.stapsdt.base\n"                                           \
+  ".pushsection .stapsdt.base,\"aG\",\"progbits\",.stapsdt.base,comdat\n" \
+  ".weak _.stapsdt.base\n"                                             \
+  ".hidden _.stapsdt.base\n"                                           \
+  "_.stapsdt.base: .space 1\n"                                         \
+  ".size _.stapsdt.base, 1\n"                                          \
+  ".popsection\n"                                                      \
+  ".endif\n"
+
+#define PROBE_NOTES 1
+#define PROBE0(name) __asm__ __volatile__(PROBE_NOTE(name, ""))
+#define PROBE1(name, a) __asm__ __volatile__(PROBE_NOTE(name, "8@%0") ::"nor"(PROBE_ARG(a)))
+#define PROBE2(name, a, b) \
+  __asm__ __volatile__(PROBE_NOTE(name, "8@%0 8@%1") ::"nor"(PROBE_ARG(a)), "nor"(PROBE_ARG(b)))
+#define PROBE3(name, a, b, c)                                          \
+  __asm__ __volatile__(PROBE_NOTE(name, "8@%0 8@%1 8@%2") ::"nor"(PROBE_ARG(a)), \
+                       "nor"(PROBE_ARG(b)), "nor"(PROBE_ARG(c)))
+
+#else
+
+#define PROBE_NOTES 0
+#define PROBE0(name) ((void)0)
+#define PROBE1(name, a) ((void)(a))
+#define PROBE2(name, a, b) ((void)(a), (void)(b))
+#define PROBE3(name, a, b, c) ((void)(a), (void)(b), (void)(c))
+
+#endif
+
+#endif
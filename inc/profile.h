@@ -0,0 +1,25 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Frames kept per sampled allocation, allocator frames that may precede
+// them, and table sizes (powers of two) for distinct stacks and live samples
+#define PROF_MAX_DEPTH 32
+#define PROF_SKIP_MAX 16
+#define PROF_STACK_SLOTS 4096
+#define PROF_SAMPLE_SLOTS 65536
+
+extern size_t prof_rate;
+
+void prof_init(void);
+bool prof_should_sample(size_t size);
+void prof_track(void *ptr, size_t size);
+void prof_untrack(void *ptr);
+
+static inline bool prof_enabled(void) {
+  return __atomic_load_n(&prof_rate, __ATOMIC_RELAXED) != 0;
+}
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// A snapshot file is a SnapshotHeader, then for each zone a SnapshotZone
+// followed by its block_count SnapshotBlocks in address order. With
+// SNAPSHOT_CONTENTS, the payloads of all allocated blocks follow, in the
+// same order as their records.
+#define SNAPSHOT_MAGIC "FTMSNAP"
+#define SNAPSHOT_VERSION 1
+
+#define SNAPSHOT_CONTENTS 0x1
+
+#define SNAPSHOT_FREE 0
+#define SNAPSHOT_ALLOCATED 1
+
+typedef struct SnapshotHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t flags;
+  uint64_t zone_count;
+  uint64_t block_count;
+  uint64_t content_bytes;
+} SnapshotHeader;
+
+typedef struct SnapshotZone {
+  uint64_t address;
+  uint64_t size;
+  uint32_t type;
+  uint32_t block_count;
+} SnapshotZone;
+
+// address and size describe the payload, as malloc() returned it
+typedef struct SnapshotBlock {
+  uint64_t address;
+  uint64_t size;
+  uint32_t status;
+  uint16_t flags;
+  uint16_t slack;
+} SnapshotBlock;
+#endif
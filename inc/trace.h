@@ -0,0 +1,72 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// A trace file is a TraceHeader followed by chunks. Each thread buffers its
+// records and appends them as one chunk: a TraceChunk header, then `bytes`
+// of encoded records. Chunks are in time order per thread but interleaved
+// between threads, so readers sort decoded records by timestamp.
+//
+// An encoded record is the op byte followed by LEB128 varints:
+//   timestamp delta from the previous record (from base for the first)
+//   size                               (malloc and realloc only)
+//   zigzag(ptr - previous ptr)         (from 0 for the first)
+//   zigzag(old_ptr - ptr)              (realloc only)
+#define TRACE_MAGIC "FTMTRACE"
+#define TRACE_VERSION 1
+
+// Encoded bytes buffered per thread before they are appended as a chunk
+#define TRACE_BUFFER_SIZE 65536
+#define TRACE_RECORD_MAX_SIZE 41
+
+typedef enum { TRACE_MALLOC, TRACE_FREE, TRACE_REALLOC } TraceOp;
+
+typedef struct TraceHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t chunk_size;
+} TraceHeader;
+
+typedef struct TraceChunk {
+  uint32_t thread;
+  uint32_t count;
+  uint32_t bytes;
+  uint32_t reserved;
+  uint64_t base;
+} TraceChunk;
+
+// Decoded form of a record. Timestamps are in the same ticks as the latency
+// histograms (TSC cycles on x86) and only serve to order records.
+// ptr is the returned block for malloc and
+// realloc and the released block for free; old_ptr is realloc's input.
+// Pointers only serve as ids.
+typedef struct TraceRecord {
+  uint64_t timestamp;
+  uint64_t size;
+  uint64_t ptr;
+  uint64_t old_ptr;
+  uint32_t thread;
+  uint32_t op;
+} TraceRecord;
+
+extern bool trace_active;
+
+void trace_init(void);
+void trace_record(TraceOp op, size_t size, void *ptr, void *old_ptr);
+
+static inline uint64_t trace_zigzag(uint64_t delta) {
+  return (delta << 1) ^ (uint64_t)((int64_t)delta >> 63);
+}
+
+static inline uint64_t trace_unzigzag(uint64_t value) {
+  return (value >> 1) ^ (uint64_t)-(int64_t)(value & 1);
+}
+
+static inline bool trace_enabled(void) {
+  return __atomic_load_n(&trace_active, __ATOMIC_RELAXED);
+}
+
+#endif
@@ -0,0 +1,27 @@
+#ifndef WRITER_H
+#define WRITER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Buffered output to a file descriptor that never allocates, for reports
+// produced from inside the allocator
+typedef struct Writer {
+  int fd;
+  char *buffer;
+  size_t capacity;
+  size_t length;
+  bool failed;
+} Writer;
+
+void writer_init(Writer *writer, int fd, char *buffer, size_t capacity);
+bool writer_flush(Writer *writer);
+void write_bytes(Writer *writer, const void *data, size_t size);
+void write_str(Writer *writer, const char *str);
+void write_char(Writer *writer, char c);
+size_t format_u64(char *buffer, uint64_t value);
+void write_u64(Writer *writer, uint64_t value);
+void write_hex(Writer *writer, uint64_t value);
+
+#endif
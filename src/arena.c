@@ -0,0 +1,224 @@
+#include "malloc.h"
+#include "internal.h"
+#include "copy.h"
+
+#include <errno.h>
+
+static Lock recycled_lock = LOCK_INITIALIZER;
+static Zone *recycled = NULL;
+static size_t recycled_count = 0;
+
+static Lock arenas_lock = LOCK_INITIALIZER;
+static Arena *arenas[ARENA_INDEX_MAX];
+
+// Zones of destroyed arenas are handed out again before anything is mapped.
+// Only the most recent one is looked at, so this stays O(1).
+static Zone *take_recycled(size_t size) {
+    Zone *zone = NULL;
+
+    lock_acquire(&recycled_lock);
+    if (recycled && recycled->size >= size) {
+        zone = recycled;
+        recycled = zone->next;
+        recycled_count--;
+    }
+    lock_release(&recycled_lock);
+    return zone;
+}
+
+// Oversized zones are unmapped rather than pinned in the pool
+static void recycle_zone(Zone *zone) {
+    if (zone->size <= 2 * ARENA_ZONE_SIZE) {
+        lock_acquire(&recycled_lock);
+        if (recycled_count < ARENA_RECYCLE_MAX) {
+            zone->next = recycled;
+            recycled = zone;
+            recycled_count++;
+            zone = NULL;
+        }
+        lock_release(&recycled_lock);
+    }
+    if (zone) unmap_zone(zone);
+}
+
+static Zone *get_zone(Arena *arena, size_t size) {
+    Zone *zone = arena->spare;
+
+    if (zone && zone->size >= size) {
+        arena->spare = zone->next;
+        return zone;
+    }
+    zone = take_recycled(size);
+    if (zone) return zone;
+    return map_zone_memory(ARENA, (size > arena->zone_size) ? size : arena->zone_size);
+}
+
+// The lowest free index is taken, so indices stay small and get reused
+static int register_arena(Arena *arena) {
+    int index = -1;
+
+    lock_acquire(&arenas_lock);
+    for (int i = 0; i < ARENA_INDEX_MAX; i++) {
+        if (!arenas[i]) {
+            arenas[i] = arena;
+            index = i;
+            break;
+        }
+    }
+    lock_release(&arenas_lock);
+    return index;
+}
+
+// The index table lock is held across the allocation, so arena_destroy()
+// cannot recycle the arena's zones while memory is being handed out of them
+void *arena_alloc_indexed(unsigned index, size_t size, size_t alignment, bool zero) {
+    void *result = NULL;
+
+    lock_acquire(&arenas_lock);
+    Arena *arena = (index < ARENA_INDEX_MAX) ? arenas[index] : NULL;
+    if (arena) {
+        result = arena_alloc_aligned(arena, size, alignment);
+        if (result && zero) fill_bytes(result, 0, size);
+    } else {
+        errno = EINVAL;
+    }
+    lock_release(&arenas_lock);
+    return result;
+}
+
+// Unmaps the zones kept for future arenas; returns how many were released
+size_t arena_trim(void) {
+    lock_acquire(&recycled_lock);
+    Zone *zone = recycled;
+    recycled = NULL;
+    recycled_count = 0;
+    lock_release(&recycled_lock);
+
+    size_t released = 0;
+    while (zone) {
+        Zone *next = zone->next;
+        unmap_zone(zone);
+        zone = next;
+        released++;
+    }
+    return released;
+}
+
+int arena_index(const Arena *arena) {
+    return arena ? arena->index : -1;
+}
+
+Arena *arena_create(size_t zone_size) {
+    if (!zone_size) zone_size = ARENA_ZONE_SIZE;
+    if (zone_size > SIZE_MAX - sizeof(Arena)) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    Zone *zone = take_recycled(zone_size + sizeof(Arena));
+    if (!zone) zone = map_zone_memory(ARENA, zone_size + sizeof(Arena));
+    if (!zone) return NULL;
+    zone->prev = NULL;
+    zone->next = NULL;
+
+    Arena *arena = (Arena *)(zone->base + zone->offset);
+    arena->cursor = (char *)(arena + 1);
+    arena->end = zone->base + zone->size;
+    arena->zones = zone;
+    arena->spare = NULL;
+    arena->home = zone;
+    arena->zone_size = zone_size;
+    arena->index = register_arena(arena);
+    return arena;
+}
+
+// The new zone always joins the front of the chain, but bumping only moves
+// to it when it has more room left than the current one, so an oversized
+// request does not strand the rest of the current zone
+void *arena_alloc_slow(Arena *arena, size_t size) {
+    size_t rounded = (size + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+
+    if (!size) return NULL;
+    if (rounded < size) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    Zone *zone = get_zone(arena, rounded);
+    if (!zone) return NULL;
+
+    zone->prev = NULL;
+    zone->next = arena->zones;
+    arena->zones->prev = zone;
+    arena->zones = zone;
+
+    char *result = zone->base + zone->offset;
+    char *end = zone->base + zone->size;
+    if ((size_t)(end - result) - rounded > (size_t)(arena->end - arena->cursor)) {
+        arena->cursor = result + rounded;
+        arena->end = end;
+    }
+    return result;
+}
+
+// The cursor is bumped up to the alignment first. A fresh zone only
+// guarantees ARENA_ALIGNMENT, so the slow path asks for enough extra room
+// to align inside it.
+void *arena_alloc_aligned(Arena *arena, size_t size, size_t alignment) {
+    if (alignment <= ARENA_ALIGNMENT) return arena_alloc(arena, size);
+
+    size_t rounded = (size + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+    if (!size) return NULL;
+    if (rounded < size || rounded > SIZE_MAX - alignment) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    uintptr_t start = ((uintptr_t)arena->cursor + alignment - 1) & ~(uintptr_t)(alignment - 1);
+    if (start >= (uintptr_t)arena->cursor && start <= (uintptr_t)arena->end &&
+        rounded <= (uintptr_t)arena->end - start) {
+        arena->cursor = (char *)start + rounded;
+        return (void *)start;
+    }
+
+    char *memory = arena_alloc_slow(arena, rounded + alignment);
+    if (!memory) return NULL;
+    return (void *)(((uintptr_t)memory + alignment - 1) & ~(uintptr_t)(alignment - 1));
+}
+
+// Every zone but the first is spliced onto spare in one step: the chain is
+// newest first, so the first zone is always its tail
+void arena_reset(Arena *arena) {
+    if (!arena) return;
+
+    Zone *home = arena->home;
+    if (arena->zones != home) {
+        Zone *last = home->prev;
+        last->next = arena->spare;
+        arena->spare = arena->zones;
+        arena->zones = home;
+        home->prev = NULL;
+    }
+    arena->cursor = (char *)(arena + 1);
+    arena->end = home->base + home->size;
+}
+
+void arena_destroy(Arena *arena) {
+    if (!arena) return;
+
+    if (arena->index >= 0) {
+        lock_acquire(&arenas_lock);
+        arenas[arena->index] = NULL;
+        lock_release(&arenas_lock);
+    }
+
+    Zone *lists[2] = {arena->zones, arena->spare};
+    for (int i = 0; i < 2; i++) {
+        Zone *zone = lists[i];
+        while (zone) {
+            Zone *next = zone->next;
+            recycle_zone(zone);
+            zone = next;
+        }
+    }
+}
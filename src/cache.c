@@ -0,0 +1,94 @@
+#include "malloc.h"
+#include "internal.h"
+#include "cache.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+
+__thread ThreadCache *thread_cache __attribute__((tls_model("initial-exec"))) = NULL;
+
+static __thread bool cache_closed __attribute__((tls_model("initial-exec"))) = false;
+
+static bool cache_enabled = false;
+static pthread_key_t cache_key;
+
+static Lock caches_lock = LOCK_INITIALIZER;
+static ThreadCache *caches = NULL;
+
+// Runs as the thread exits: its blocks go back to the shared TINY heap,
+// where empty zones are released as usual, and anything it frees from a
+// later destructor bypasses the cache
+static void exit_thread(void *arg) {
+    ThreadCache *cache = arg;
+
+    cache_closed = true;
+    thread_cache = NULL;
+    cache_flush(cache);
+
+    lock_acquire(&caches_lock);
+    if (cache->prev) cache->prev->next = cache->next;
+    else caches = cache->next;
+    if (cache->next) cache->next->prev = cache->prev;
+    lock_release(&caches_lock);
+
+    munmap(cache, sizeof(ThreadCache));
+}
+
+// Caches come from mmap so creating one never calls back into malloc
+ThreadCache *cache_create(void) {
+    if (cache_closed || !__atomic_load_n(&cache_enabled, __ATOMIC_ACQUIRE)) return NULL;
+
+    void *memory = mmap(NULL, sizeof(ThreadCache), PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) {
+        cache_closed = true;
+        return NULL;
+    }
+
+    ThreadCache *cache = memory;
+    lock_acquire(&caches_lock);
+    cache->next = caches;
+    if (caches) caches->prev = cache;
+    caches = cache;
+    lock_release(&caches_lock);
+
+    thread_cache = cache;
+    pthread_setspecific(cache_key, cache);
+    return cache;
+}
+
+// Sums what live threads have handed out from their caches but not yet
+// folded into the TINY stats
+void cache_pending(size_t *allocations, size_t *bytes) {
+    *allocations = 0;
+    *bytes = 0;
+
+    lock_acquire(&caches_lock);
+    for (ThreadCache *cache = caches; cache; cache = cache->next) {
+        *allocations += __atomic_load_n(&cache->allocations, __ATOMIC_RELAXED);
+        *bytes += __atomic_load_n(&cache->bytes, __ATOMIC_RELAXED);
+    }
+    lock_release(&caches_lock);
+}
+
+// FT_MALLOC_THREAD_CACHE=0 turns the per-thread caches off
+void cache_init(void) {
+    const char *value = getenv("FT_MALLOC_THREAD_CACHE");
+
+    if (value && value[0] == '0' && !value[1]) return;
+    if (pthread_key_create(&cache_key, exit_thread) != 0) return;
+    __atomic_store_n(&cache_enabled, true, __ATOMIC_RELEASE);
+}
+
+// Threads that have no cache yet will not get one, since creating it maps
+// memory. Existing caches keep working.
+void cache_disable(void) {
+    __atomic_store_n(&cache_enabled, false, __ATOMIC_RELEASE);
+}
+
+// For threads that go idle for long: hands the calling thread's cached
+// blocks back without waiting for it to exit
+void malloc_thread_flush(void) {
+    if (thread_cache) cache_flush(thread_cache);
+}
@@ -0,0 +1,255 @@
+#include "copy.h"
+#include "libft.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+size_t copy_stream_threshold = COPY_STREAM_MIN;
+
+static void *copy_libft(void *dst, const void *src, size_t size) {
+    return ft_memcpy(dst, src, size);
+}
+
+static void *fill_libft(void *dst, int value, size_t size) {
+    return ft_memset(dst, value, size);
+}
+
+#if defined(__x86_64__)
+
+// Below one vector: two overlapping moves from both ends cover every size
+static inline void copy_small(char *dst, const char *src, size_t size) {
+    if (size >= 8) {
+        uint64_t head, tail;
+        __builtin_memcpy(&head, src, 8);
+        __builtin_memcpy(&tail, src + size - 8, 8);
+        __builtin_memcpy(dst, &head, 8);
+        __builtin_memcpy(dst + size - 8, &tail, 8);
+    } else if (size >= 4) {
+        uint32_t head, tail;
+        __builtin_memcpy(&head, src, 4);
+        __builtin_memcpy(&tail, src + size - 4, 4);
+        __builtin_memcpy(dst, &head, 4);
+        __builtin_memcpy(dst + size - 4, &tail, 4);
+    } else if (size) {
+        dst[0] = src[0];
+        dst[size / 2] = src[size / 2];
+        dst[size - 1] = src[size - 1];
+    }
+}
+
+static inline void fill_small(char *dst, uint64_t pattern, size_t size) {
+    if (size >= 8) {
+        __builtin_memcpy(dst, &pattern, 8);
+        __builtin_memcpy(dst + size - 8, &pattern, 8);
+    } else if (size >= 4) {
+        __builtin_memcpy(dst, &pattern, 4);
+        __builtin_memcpy(dst + size - 4, &pattern, 4);
+    } else if (size) {
+        dst[0] = (char)pattern;
+        dst[size / 2] = (char)pattern;
+        dst[size - 1] = (char)pattern;
+    }
+}
+
+// The first and last vectors are moved unaligned, and everything between
+// with stores aligned on the destination, which overlap them as needed.
+// Above the threshold the aligned stores bypass the cache.
+static void *copy_sse2(void *dst, const void *src, size_t size) {
+    char *out = dst;
+    const char *in = src;
+
+    if (size < 16) {
+        copy_small(out, in, size);
+        return dst;
+    }
+
+    __m128i head = _mm_loadu_si128((const __m128i *)in);
+    __m128i tail = _mm_loadu_si128((const __m128i *)(in + size - 16));
+    char *last = out + size - 16;
+    size_t skew = 16 - ((uintptr_t)out & 15);
+    char *cursor = out + skew;
+    in += skew;
+
+    if (size >= copy_stream_threshold) {
+        for (; cursor + 64 <= last; cursor += 64, in += 64) {
+            __m128i a = _mm_loadu_si128((const __m128i *)in);
+            __m128i b = _mm_loadu_si128((const __m128i *)(in + 16));
+            __m128i c = _mm_loadu_si128((const __m128i *)(in + 32));
+            __m128i d = _mm_loadu_si128((const __m128i *)(in + 48));
+            _mm_stream_si128((__m128i *)cursor, a);
+            _mm_stream_si128((__m128i *)(cursor + 16), b);
+            _mm_stream_si128((__m128i *)(cursor + 32), c);
+            _mm_stream_si128((__m128i *)(cursor + 48), d);
+        }
+        _mm_sfence();
+    }
+    for (; cursor + 64 <= last; cursor += 64, in += 64) {
+        __m128i a = _mm_loadu_si128((const __m128i *)in);
+        __m128i b = _mm_loadu_si128((const __m128i *)(in + 16));
+        __m128i c = _mm_loadu_si128((const __m128i *)(in + 32));
+        __m128i d = _mm_loadu_si128((const __m128i *)(in + 48));
+        _mm_store_si128((__m128i *)cursor, a);
+        _mm_store_si128((__m128i *)(cursor + 16), b);
+        _mm_store_si128((__m128i *)(cursor + 32), c);
+        _mm_store_si128((__m128i *)(cursor + 48), d);
+    }
+    for (; cursor < last; cursor += 16, in += 16) {
+        _mm_store_si128((__m128i *)cursor, _mm_loadu_si128((const __m128i *)in));
+    }
+    _mm_storeu_si128((__m128i *)out, head);
+    _mm_storeu_si128((__m128i *)last, tail);
+    return dst;
+}
+
+static void *fill_sse2(void *dst, int value, size_t size) {
+    char *out = dst;
+
+    if (size < 16) {
+        fill_small(out, 0x0101010101010101ULL * (uint8_t)value, size);
+        return dst;
+    }
+
+    __m128i pattern = _mm_set1_epi8((char)value);
+    char *last = out + size - 16;
+    char *cursor = out + 16 - ((uintptr_t)out & 15);
+
+    if (size >= copy_stream_threshold) {
+        for (; cursor + 64 <= last; cursor += 64) {
+            _mm_stream_si128((__m128i *)cursor, pattern);
+            _mm_stream_si128((__m128i *)(cursor + 16), pattern);
+            _mm_stream_si128((__m128i *)(cursor + 32), pattern);
+            _mm_stream_si128((__m128i *)(cursor + 48), pattern);
+        }
+        _mm_sfence();
+    }
+    for (; cursor + 64 <= last; cursor += 64) {
+        _mm_store_si128((__m128i *)cursor, pattern);
+        _mm_store_si128((__m128i *)(cursor + 16), pattern);
+        _mm_store_si128((__m128i *)(cursor + 32), pattern);
+        _mm_store_si128((__m128i *)(cursor + 48), pattern);
+    }
+    for (; cursor < last; cursor += 16) _mm_store_si128((__m128i *)cursor, pattern);
+    _mm_storeu_si128((__m128i *)out, pattern);
+    _mm_storeu_si128((__m128i *)last, pattern);
+    return dst;
+}
+
+// Same layout as the SSE2 versions with 32-byte vectors; blocks below two
+// vectors are left to those
+__attribute__((target("avx2")))
+static void *copy_avx2(void *dst, const void *src, size_t size) {
+    if (size < 64) return copy_sse2(dst, src, size);
+
+    char *out = dst;
+    const char *in = src;
+    __m256i head = _mm256_loadu_si256((const __m256i *)in);
+    __m256i tail = _mm256_loadu_si256((const __m256i *)(in + size - 32));
+    char *last = out + size - 32;
+    size_t skew = 32 - ((uintptr_t)out & 31);
+    char *cursor = out + skew;
+    in += skew;
+
+    if (size >= copy_stream_threshold) {
+        for (; cursor + 128 <= last; cursor += 128, in += 128) {
+            __m256i a = _mm256_loadu_si256((const __m256i *)in);
+            __m256i b = _mm256_loadu_si256((const __m256i *)(in + 32));
+            __m256i c = _mm256_loadu_si256((const __m256i *)(in + 64));
+            __m256i d = _mm256_loadu_si256((const __m256i *)(in + 96));
+            _mm256_stream_si256((__m256i *)cursor, a);
+            _mm256_stream_si256((__m256i *)(cursor + 32), b);
+            _mm256_stream_si256((__m256i *)(cursor + 64), c);
+            _mm256_stream_si256((__m256i *)(cursor + 96), d);
+        }
+        _mm_sfence();
+    }
+    for (; cursor + 128 <= last; cursor += 128, in += 128) {
+        __m256i a = _mm256_loadu_si256((const __m256i *)in);
+        __m256i b = _mm256_loadu_si256((const __m256i *)(in + 32));
+        __m256i c = _mm256_loadu_si256((const __m256i *)(in + 64));
+        __m256i d = _mm256_loadu_si256((const __m256i *)(in + 96));
+        _mm256_store_si256((__m256i *)cursor, a);
+        _mm256_store_si256((__m256i *)(cursor + 32), b);
+        _mm256_store_si256((__m256i *)(cursor + 64), c);
+        _mm256_store_si256((__m256i *)(cursor + 96), d);
+    }
+    for (; cursor < last; cursor += 32, in += 32) {
+        _mm256_store_si256((__m256i *)cursor, _mm256_loadu_si256((const __m256i *)in));
+    }
+    _mm256_storeu_si256((__m256i *)out, head);
+    _mm256_storeu_si256((__m256i *)last, tail);
+    _mm256_zeroupper();
+    return dst;
+}
+
+__attribute__((target("avx2")))
+static void *fill_avx2(void *dst, int value, size_t size) {
+    if (size < 64) return fill_sse2(dst, value, size);
+
+    char *out = dst;
+    __m256i pattern = _mm256_set1_epi8((char)value);
+    char *last = out + size - 32;
+    char *cursor = out + 32 - ((uintptr_t)out & 31);
+
+    if (size >= copy_stream_threshold) {
+        for (; cursor + 128 <= last; cursor += 128) {
+            _mm256_stream_si256((__m256i *)cursor, pattern);
+            _mm256_stream_si256((__m256i *)(cursor + 32), pattern);
+            _mm256_stream_si256((__m256i *)(cursor + 64), pattern);
+            _mm256_stream_si256((__m256i *)(cursor + 96), pattern);
+        }
+        _mm_sfence();
+    }
+    for (; cursor + 128 <= last; cursor += 128) {
+        _mm256_store_si256((__m256i *)cursor, pattern);
+        _mm256_store_si256((__m256i *)(cursor + 32), pattern);
+        _mm256_store_si256((__m256i *)(cursor + 64), pattern);
+        _mm256_store_si256((__m256i *)(cursor + 96), pattern);
+    }
+    for (; cursor < last; cursor += 32) _mm256_store_si256((__m256i *)cursor, pattern);
+    _mm256_storeu_si256((__m256i *)out, pattern);
+    _mm256_storeu_si256((__m256i *)last, pattern);
+    _mm256_zeroupper();
+    return dst;
+}
+
+// SSE2 is part of the x86-64 baseline
+CopyKernel copy_kernel = copy_sse2;
+FillKernel fill_kernel = fill_sse2;
+
+#else
+
+CopyKernel copy_kernel = copy_libft;
+FillKernel fill_kernel = fill_libft;
+
+#endif
+
+// FT_MALLOC_COPY=libft, sse2 or avx2 forces a kernel, for comparing them;
+// one the CPU lacks is ignored
+__attribute__((constructor))
+static void copy_init(void) {
+    const char *forced = getenv("FT_MALLOC_COPY");
+
+#if defined(_SC_LEVEL2_CACHE_SIZE)
+    long cache_size = sysconf(_SC_LEVEL2_CACHE_SIZE);
+    if (cache_size > 0 && (size_t)cache_size > copy_stream_threshold) copy_stream_threshold = (size_t)cache_size;
+#endif
+
+    if (forced && !ft_strncmp(forced, "libft", 6)) {
+        copy_kernel = copy_libft;
+        fill_kernel = fill_libft;
+        return;
+    }
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    if (forced && !ft_strncmp(forced, "sse2", 5)) return;
+    if (__builtin_cpu_supports("avx2")) {
+        copy_kernel = copy_avx2;
+        fill_kernel = fill_avx2;
+    }
+#endif
+}
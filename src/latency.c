@@ -0,0 +1,109 @@
+#include "malloc.h"
+#include "internal.h"
+#include "latency.h"
+#include "writer.h"
+
+#include <unistd.h>
+
+static LatencyHistogram histograms[LATENCY_OPS][3];
+
+// Every field is a relaxed atomic, so threads record without any lock and
+// readers see each counter whole, if not all counters from the same instant
+void latency_add(LatencyOp op, int type, uint64_t ticks) {
+    LatencyHistogram *histogram = &histograms[op][type];
+    size_t bucket = 63 - (size_t)__builtin_clzll(ticks | 1);
+
+    if (bucket >= LATENCY_BUCKETS) bucket = LATENCY_BUCKETS - 1;
+
+    __atomic_fetch_add(&histogram->count, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&histogram->total, ticks, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&histogram->buckets[bucket], 1, __ATOMIC_RELAXED);
+
+    size_t max = __atomic_load_n(&histogram->max, __ATOMIC_RELAXED);
+    while (ticks > max && !__atomic_compare_exchange_n(&histogram->max, &max, ticks, true,
+                                                       __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+void malloc_get_latency(MallocLatency *latency) {
+    if (!latency) return;
+
+#if defined(__x86_64__) || defined(__i386__)
+    latency->unit = "cycles";
+#else
+    latency->unit = "ns";
+#endif
+    for (int op = 0; op < LATENCY_OPS; op++) {
+        for (int type = TINY; type <= LARGE; type++) {
+            LatencyHistogram *from = &histograms[op][type];
+            LatencyHistogram *to = &latency->ops[op][type];
+
+            to->count = __atomic_load_n(&from->count, __ATOMIC_RELAXED);
+            to->total = __atomic_load_n(&from->total, __ATOMIC_RELAXED);
+            to->max = __atomic_load_n(&from->max, __ATOMIC_RELAXED);
+            for (int i = 0; i < LATENCY_BUCKETS; i++) {
+                to->buckets[i] = __atomic_load_n(&from->buckets[i], __ATOMIC_RELAXED);
+            }
+        }
+    }
+}
+
+// Upper bound of the bucket holding the given per-mille rank
+size_t malloc_latency_percentile(const LatencyHistogram *histogram, size_t per_mille) {
+    size_t seen = 0;
+    size_t rank = 0;
+
+    for (int i = 0; i < LATENCY_BUCKETS; i++) rank += histogram->buckets[i];
+    rank = (rank * per_mille + 999) / 1000;
+
+    for (int i = 0; i < LATENCY_BUCKETS; i++) {
+        seen += histogram->buckets[i];
+        if (seen && seen >= rank) return (size_t)2 << i;
+    }
+    return 0;
+}
+
+#if MALLOC_LATENCY
+static const char *op_names[LATENCY_OPS] = {"malloc", "free", "realloc", "map", "lock wait"};
+static const char *class_names[3] = {"TINY", "SMALL", "LARGE"};
+
+static void write_histogram(Writer *writer, int op, int type, LatencyHistogram *histogram) {
+    write_str(writer, op_names[op]);
+    write_char(writer, ' ');
+    write_str(writer, class_names[type]);
+    write_str(writer, " : count ");
+    write_u64(writer, histogram->count);
+    write_str(writer, ", mean ");
+    write_u64(writer, histogram->total / histogram->count);
+    write_str(writer, ", p50 < ");
+    write_u64(writer, malloc_latency_percentile(histogram, 500));
+    write_str(writer, ", p99 < ");
+    write_u64(writer, malloc_latency_percentile(histogram, 990));
+    write_str(writer, ", p99.9 < ");
+    write_u64(writer, malloc_latency_percentile(histogram, 999));
+    write_str(writer, ", max ");
+    write_u64(writer, histogram->max);
+    write_char(writer, '\n');
+}
+
+__attribute__((destructor))
+static void latency_exit(void) {
+    static MallocLatency latency;
+    char buffer[4096];
+    Writer writer;
+
+    malloc_get_latency(&latency);
+    writer_init(&writer, STDERR_FILENO, buffer, sizeof(buffer));
+
+    write_str(&writer, "malloc latency (");
+    write_str(&writer, latency.unit);
+    write_str(&writer, ")\n");
+    for (int op = 0; op < LATENCY_OPS; op++) {
+        for (int type = TINY; type <= LARGE; type++) {
+            LatencyHistogram *histogram = &latency.ops[op][type];
+            if (histogram->count) write_histogram(&writer, op, type, histogram);
+        }
+    }
+    writer_flush(&writer);
+}
+#endif
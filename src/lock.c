@@ -0,0 +1,118 @@
+#include "lock.h"
+#include "probe.h"
+
+#include <sched.h>
+#include <unistd.h>
+
+#include <limits.h>
+
+#if defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
+static inline void cpu_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+static void park(Lock *lock) {
+#if defined(__linux__)
+    syscall(SYS_futex, &lock->state, FUTEX_WAIT_PRIVATE, CONTENDED, NULL, NULL, 0);
+#else
+    (void)lock;
+    sched_yield();
+#endif
+}
+
+void lock_wake(Lock *lock) {
+#if defined(__linux__)
+    syscall(SYS_futex, &lock->state, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+#else
+    (void)lock;
+#endif
+}
+
+static void wake_all(Lock *lock) {
+#if defined(__linux__)
+    syscall(SYS_futex, &lock->state, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+#else
+    (void)lock;
+#endif
+}
+
+// Allocator critical sections are a few hundred cycles, so a waiter first
+// spins with bounded exponential backoff and only parks in the kernel once
+// the holder has clearly been descheduled or is doing slow work (mmap).
+// Waiters on a spin-only lock never stop spinning, and a parked waiter that
+// wakes to find the lock made spin-only goes back to spinning. Spins and
+// parks are counted locally and published once the lock is held.
+void lock_acquire_slow(Lock *lock) {
+    __atomic_fetch_add(&lock->stats.contended, 1, __ATOMIC_RELAXED);
+    PROBE1(lock_contended, lock);
+
+    size_t spins = 0;
+    int parks = 0;
+    for (;;) {
+        bool spin_only = __atomic_load_n(&lock->spin_only, __ATOMIC_RELAXED);
+        unsigned backoff = 1;
+        for (size_t round = 0; round < LOCK_SPIN_LIMIT || spin_only; round++) {
+            for (unsigned i = 0; i < backoff; i++) cpu_relax();
+            spins++;
+
+            if (__atomic_load_n(&lock->state, __ATOMIC_RELAXED) == UNLOCKED && lock_try_acquire(lock)) {
+                __atomic_fetch_add(&lock->stats.spins, spins, __ATOMIC_RELAXED);
+                __atomic_fetch_add(&lock->stats.parks, parks, __ATOMIC_RELAXED);
+                PROBE3(lock_acquired, lock, spins, parks);
+                return;
+            }
+            if (backoff < LOCK_BACKOFF_MAX) backoff <<= 1;
+        }
+
+        // Marking the lock contended makes the holder wake one waiter on
+        // release. A waiter that wins here keeps the contended mark, which
+        // at worst costs one spurious wake. spin_only is checked after
+        // parked is raised, so lock_set_spin_only() either sees this waiter
+        // or this waiter sees spin_only.
+        __atomic_fetch_add(&lock->parked, 1, __ATOMIC_SEQ_CST);
+        bool acquired = false;
+        while (!__atomic_load_n(&lock->spin_only, __ATOMIC_SEQ_CST)) {
+            if (__atomic_exchange_n(&lock->state, CONTENDED, __ATOMIC_ACQUIRE) == UNLOCKED) {
+                acquired = true;
+                break;
+            }
+            park(lock);
+            parks++;
+        }
+        __atomic_fetch_sub(&lock->parked, 1, __ATOMIC_RELEASE);
+
+        if (acquired) {
+            __atomic_fetch_add(&lock->stats.spins, spins, __ATOMIC_RELAXED);
+            __atomic_fetch_add(&lock->stats.parks, parks, __ATOMIC_RELAXED);
+            PROBE3(lock_acquired, lock, spins, parks);
+            return;
+        }
+    }
+}
+
+// Called with the lock held. Waiters that parked before the switch are
+// woken until none is left in the kernel, then the contended mark they
+// left is cleared, so the holder's next release makes no syscall either.
+void lock_set_spin_only(Lock *lock) {
+    __atomic_store_n(&lock->spin_only, 1, __ATOMIC_SEQ_CST);
+    while (__atomic_load_n(&lock->parked, __ATOMIC_SEQ_CST)) {
+        wake_all(lock);
+        sched_yield();
+    }
+    __atomic_store_n(&lock->state, LOCKED, __ATOMIC_RELAXED);
+}
+
+void lock_get_stats(Lock *lock, LockStats *stats) {
+    stats->acquisitions = __atomic_load_n(&lock->stats.acquisitions, __ATOMIC_RELAXED);
+    stats->contended = __atomic_load_n(&lock->stats.contended, __ATOMIC_RELAXED);
+    stats->spins = __atomic_load_n(&lock->stats.spins, __ATOMIC_RELAXED);
+    stats->parks = __atomic_load_n(&lock->stats.parks, __ATOMIC_RELAXED);
+}
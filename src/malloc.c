@@ -1,10 +1,31 @@
 #include "malloc.h"
+#include "internal.h"
+#include "bitmap.h"
+#include "cache.h"
+#include "copy.h"
+#include "latency.h"
+#include "libft.h"
+#include "pagemap.h"
+#include "probe.h"
+#include "profile.h"
+#include "trace.h"
+
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+static Heap heaps[3];
+static size_t mapped_size = 0;
+static int options_ready = 0;
+
+static inline void lock_heap(Heap *heap) {
+    uint64_t start = latency_start();
+    lock_acquire(&heap->lock);
+    latency_record(LATENCY_LOCK_WAIT, (int)(heap - heaps), start);
+}
 
-static Zone *base = NULL;
-static pthread_mutex_t malloc_mutex = PTHREAD_MUTEX_INITIALIZER;
-
-static inline void lock_malloc() { pthread_mutex_lock(&malloc_mutex); }
-static inline void unlock_malloc() { pthread_mutex_unlock(&malloc_mutex); }
+static inline void unlock_heap(Heap *heap) { lock_release(&heap->lock); }
 
 static inline size_t align(size_t value, size_t alignment) {
     return ((value + alignment - 1) & ~(alignment - 1));
@@ -14,38 +35,103 @@ static inline void *get_block_start(Block *block) {
     return (char *)block + sizeof(Block);
 }
 
+static inline void set_slack(Block *block, size_t requested) {
+    size_t slack = block->size - sizeof(Block) - requested;
+    block->slack = (slack < UINT16_MAX) ? (uint16_t)slack : UINT16_MAX;
+}
+
 static inline void *get_zone_start(Zone *zone) {
-    return (char *)zone + sizeof(Zone);
+    return zone->base + zone->offset;
 }
 
 static inline size_t get_block_size(Block *block) {
     return block->size - sizeof(Block);
 }
 
-static void add_to_free_list(Zone *zone, Block *block) {
-    if (!zone || !block) return;
+// Counters only change under their heap's lock, so a plain read-modify-write
+// suffices; the relaxed store keeps lock-free readers from seeing torn values.
+static inline void stat_add(size_t *counter, size_t value) {
+    __atomic_store_n(counter, *counter + value, __ATOMIC_RELAXED);
+}
 
-    block->free_next = zone->free_blocks;
-    block->free_prev = NULL;
+static inline void stat_sub(size_t *counter, size_t value) {
+    __atomic_store_n(counter, *counter - value, __ATOMIC_RELAXED);
+}
 
-    if (zone->free_blocks) {
-        zone->free_blocks->free_prev = block;
+// Called once in_use has settled, since a split first counts the whole
+// block as in use
+static inline void update_peak(Heap *heap) {
+    if (heap->stats.in_use > heap->stats.peak) {
+        __atomic_store_n(&heap->stats.peak, heap->stats.in_use, __ATOMIC_RELAXED);
     }
-    zone->free_blocks = block;
 }
 
-static void remove_from_free_list(Zone *zone, Block *block) {
-    if (!zone || !block) return;
+static inline bool is_heap_ready(Heap *heap) {
+    return __atomic_load_n(&heap->ready, __ATOMIC_ACQUIRE);
+}
 
-    if (block->free_prev) {
-        block->free_prev->free_next = block->free_next;
-    } else {
-        zone->free_blocks = block->free_next;
+// Process-wide options are read once, on the first use of any size class
+static void init_options(void) {
+    int expected = 0;
+
+    if (__atomic_compare_exchange_n(&options_ready, &expected, 1, false,
+                                    __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+        prof_init();
+        trace_init();
+        cache_init();
     }
+}
 
-    if (block->free_next) {
-        block->free_next->free_prev = block->free_prev;
+// Heaps are set up on first use of their size class; once ready the check
+// is a single acquire load and never touches the lock.
+static Heap *get_heap(ZoneType type) {
+    Heap *heap = &heaps[type];
+    if (is_heap_ready(heap)) return heap;
+
+    init_options();
+    lock_heap(heap);
+    if (!heap->ready) {
+        heap->type = type;
+        switch (type) {
+            case TINY: heap->zone_size = TINY_ZONE_SIZE; break;
+            case SMALL: heap->zone_size = SMALL_ZONE_SIZE; break;
+            default: heap->zone_size = 0; break;
+        }
+        __atomic_store_n(&heap->ready, true, __ATOMIC_RELEASE);
     }
+    unlock_heap(heap);
+    return heap;
+}
+
+_Static_assert(BIN_EXACT_COUNT + (64 - BIN_EXACT_SHIFT) * 4 <= HEAP_BINS, "a bin for every block size");
+
+// lzcnt gives the power of two above the exact bins, and the next two bits
+// the quarter of it
+static inline int get_bin(size_t size) {
+    if (size < BIN_EXACT_LIMIT) return (int)(size / ALIGNMENT);
+
+    int log = 63 - __builtin_clzl(size);
+    return (int)BIN_EXACT_COUNT + (log - BIN_EXACT_SHIFT) * 4 + (int)((size >> (log - 2)) & 3);
+}
+
+// A block's size must not change while it is binned
+static void add_to_free_list(Heap *heap, Block *block) {
+    int bin = get_bin(block->size);
+
+    block->free_prev = NULL;
+    block->free_next = heap->bins[bin];
+    if (heap->bins[bin]) heap->bins[bin]->free_prev = block;
+    else bitmap_set(heap->bin_map, bin);
+    heap->bins[bin] = block;
+}
+
+static void remove_from_free_list(Heap *heap, Block *block) {
+    int bin = get_bin(block->size);
+
+    if (block->free_prev) block->free_prev->free_next = block->free_next;
+    else heap->bins[bin] = block->free_next;
+    if (block->free_next) block->free_next->free_prev = block->free_prev;
+    if (!heap->bins[bin]) bitmap_clear(heap->bin_map, bin);
 
     block->free_prev = NULL;
     block->free_next = NULL;
@@ -81,46 +167,12 @@ static bool has_block_cycle(Block *start) {
     return true;
 }
 
-static size_t get_alloc_blocks_size(void) {
-    size_t size = 0;
-    Zone *zone = base;
-
-    if (has_zone_cycle(zone)) return 0;
-
-    while (zone) {
-        Block *block = zone->blocks;
-        if (has_block_cycle(block)) break;
-
-        while (block) {
-            if (block->status == ALLOCATED) {
-                size += get_block_size(block);
-            }
-            block = block->next;
-        }
-        zone = zone->next;
-    }
-    return size;
-}
-
-static size_t get_alloc_zones_size(void) {
-    size_t size = 0;
-    Zone *zone = base;
-
-    if (has_zone_cycle(zone)) return 0;
-
-    while (zone) {
-        size += zone->size;
-        zone = zone->next;
-    }
-    return size;
-}
-
 static bool can_alloc(size_t size) {
     struct rlimit limits;
     if (getrlimit(RLIMIT_AS, &limits) != 0) return false;
     if (limits.rlim_cur == RLIM_INFINITY) return true;
 
-    return (get_alloc_zones_size() + size <= limits.rlim_cur);
+    return (__atomic_load_n(&mapped_size, __ATOMIC_RELAXED) + size <= limits.rlim_cur);
 }
 
 static size_t get_os_page_size(void) {
@@ -139,57 +191,87 @@ static size_t get_os_page_size(void) {
     return page_size;
 }
 
-static Block *get_block_from_ptr(void *ptr) {
-    if (!ptr) return NULL;
-
-    Zone *zone = base;
-    if (has_zone_cycle(zone)) return NULL;
+// A header is trusted only if it lies inside the zone and both neighbours
+// point back at it, so a pointer into the middle of a block is rejected
+// without walking the zone. Every neighbour is bounds-checked before it is
+// dereferenced.
+static bool is_block_header(Zone *zone, Block *block) {
+    char *zone_start = get_zone_start(zone);
+    char *zone_end = zone->base + zone->size;
+
+    if ((char *)block < zone_start || (char *)block + sizeof(Block) > zone_end ||
+        (uintptr_t)block % ALIGNMENT) {
+        return false;
+    }
+    if (block->size < sizeof(Block) || block->size > (size_t)(zone_end - (char *)block)) {
+        return false;
+    }
 
-    while (zone) {
-        if (!zone->size) break;
-
-        void *zone_start = get_zone_start(zone);
-        void *zone_end = (char *)zone + zone->size;
-
-        if (ptr >= zone_start && ptr < zone_end) {
-            Block *block = zone->blocks;
-            if (has_block_cycle(block)) return NULL;
-
-            while (block) {
-                // Bounds and sanity checks
-                if ((void *)block < zone_start || (void *)block >= zone_end ||
-                    block->size < sizeof(Block) || block->size > zone->size) {
-                    break;
-                }
-
-                if (get_block_start(block) == ptr) {
-                    return block;
-                }
-                block = block->next;
-            }
-            return NULL;
-        }
-        zone = zone->next;
+    Block *prev = block->prev;
+    if (!prev) {
+        if (zone->blocks != block) return false;
+    } else if ((char *)prev < zone_start || prev >= block ||
+               (uintptr_t)prev % ALIGNMENT || prev->next != block) {
+        return false;
     }
-    return NULL;
+
+    Block *next = block->next;
+    if (!next) return (char *)block + block->size == zone_end;
+    return (char *)next == (char *)block + block->size &&
+           (char *)next + sizeof(Block) <= zone_end && next->prev == block;
 }
 
-static Zone *get_zone_from_block(Block *block) {
-    if (!block) return NULL;
+static inline Zone *get_entry_zone(uintptr_t entry) {
+    return (Zone *)(entry & ~PAGEMAP_TYPE_MASK);
+}
 
-    Zone *zone = base;
-    if (has_zone_cycle(zone)) return NULL;
+// A block a thread cache hands out keeps the CACHED status it was given
+// under the TINY lock, so the owner never writes a header field that heap
+// walks read. The owner marks it live in free_prev instead, which is only
+// read for FREE blocks, and keeps the sampling bit in the pointer's low bit.
+#define CACHED_LIVE_SAMPLED ((uintptr_t)1)
 
-    while (zone) {
-        void *zone_start = get_zone_start(zone);
-        void *zone_end = (char *)zone + zone->size;
+static inline bool is_cached_live(Block *block) {
+    return block->status == CACHED &&
+           ((uintptr_t)block->free_prev & ~CACHED_LIVE_SAMPLED) == (uintptr_t)block;
+}
 
-        if ((void *)block >= zone_start && (void *)block < zone_end) {
-            return zone;
-        }
-        zone = zone->next;
+// Turns a live cached block into an ordinary allocated one, with the lock
+// held. The requested size was not recorded, so slack starts over at 0.
+static void adopt_cached(Block *block) {
+    block->flags = ((uintptr_t)block->free_prev & CACHED_LIVE_SAMPLED) ? BLOCK_SAMPLED : 0;
+    block->slack = 0;
+    block->free_prev = NULL;
+    block->status = ALLOCATED;
+}
+
+// Finds the zone through the page map. The entry read without a lock only
+// says which class to lock: zones are registered and unregistered under
+// their class lock, so the entry is trusted once it reads the same under
+// it. When a block is found its heap is returned locked, and the caller
+// must unlock it. A block handed out by a thread cache is adopted here.
+static Block *get_block_from_ptr(void *ptr, Heap **owner, Zone **owner_zone) {
+    uintptr_t entry = pagemap_get(ptr);
+    if (!entry) return NULL;
+
+    Heap *heap = &heaps[entry & PAGEMAP_TYPE_MASK];
+    lock_heap(heap);
+    if (pagemap_get(ptr) != entry) {
+        unlock_heap(heap);
+        return NULL;
     }
-    return NULL;
+
+    Zone *zone = get_entry_zone(entry);
+    Block *block = (Block *)((char *)ptr - sizeof(Block));
+    if (!is_block_header(zone, block)) {
+        unlock_heap(heap);
+        return NULL;
+    }
+    if (is_cached_live(block)) adopt_cached(block);
+
+    *owner = heap;
+    *owner_zone = zone;
+    return block;
 }
 
 static inline ZoneType get_zone_type(size_t size) {
@@ -198,50 +280,114 @@ static inline ZoneType get_zone_type(size_t size) {
 }
 
 static const char *get_zone_type_str(ZoneType type) {
-    static const char *type_names[] = {"TINY", "SMALL", "LARGE", "UNKNOWN"};
-    return type_names[(type < 3) ? type : 3];
+    static const char *type_names[] = {"TINY", "SMALL", "LARGE", "ARENA", "UNKNOWN"};
+    return type_names[(type <= ARENA) ? type : ARENA + 1];
 }
 
-static Zone *get_zone(ZoneType type, size_t size) {
-    size_t zone_size;
+// Maps a zone with room for size bytes, counted against RLIMIT_AS like
+// every other mapping. The zone has no blocks yet.
+Zone *map_zone_memory(ZoneType type, size_t size) {
+    size_t zone_size = align(size, get_os_page_size());
 
-    switch (type) {
-        case TINY: zone_size = TINY_ZONE_SIZE; break;
-        case SMALL: zone_size = SMALL_ZONE_SIZE; break;
-        default: zone_size = size; break;
+    if (zone_size < size || !can_alloc(zone_size)) {
+        errno = ENOMEM;
+        return NULL;
     }
 
-    zone_size = align(zone_size + sizeof(Zone), get_os_page_size());
-
-    if (!can_alloc(zone_size)) {
+    Zone *zone = zone_descriptor_alloc();
+    if (!zone) {
         errno = ENOMEM;
         return NULL;
     }
 
     void *memory = mmap(NULL, zone_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
     if (memory == MAP_FAILED) {
+        zone_descriptor_free(zone);
         errno = ENOMEM;
         return NULL;
     }
+    __atomic_fetch_add(&mapped_size, zone_size, __ATOMIC_RELAXED);
 
-    Zone *zone = (Zone *)memory;
+    zone->base = memory;
     zone->size = zone_size;
     zone->type = type;
-    zone->free_blocks = NULL;
+    zone->offset = 0;
+    zone->live = 0;
+    zone->blocks = NULL;
+    zone->prev = NULL;
+    zone->next = NULL;
+
+    PROBE3(zone_map, zone, zone_size, type);
+    return zone;
+}
+
+// Makes the whole payload of a new zone one free block
+static void init_zone_block(Zone *zone, uint16_t flags) {
+    Block *block = (Block *)get_zone_start(zone);
+    block->size = zone->size - zone->offset;
+    block->status = FREE;
+    block->flags = flags;
+    block->prev = NULL;
+    block->next = NULL;
+    block->free_prev = NULL;
+    block->free_next = NULL;
+    zone->blocks = block;
+}
+
+// Maps a zone for the heap without linking it, so LARGE zones can be mapped
+// without holding the class lock. TINY/SMALL callers hold the lock, since
+// the zone size depends on the class's zone count.
+static Zone *map_zone(Heap *heap, size_t size) {
+    size_t zone_size = size;
 
-    if (!base || zone < base) {
+    if (heap->type != LARGE) {
+        size_t shift = (heap->zone_count < ZONE_GROWTH_MAX_SHIFT) ? heap->zone_count : ZONE_GROWTH_MAX_SHIFT;
+        zone_size = heap->zone_size << shift;
+    }
+
+    uint64_t start = latency_start();
+    Zone *zone = map_zone_memory(heap->type, zone_size);
+    latency_record(LATENCY_MAP, heap->type, start);
+    if (!zone) return NULL;
+
+    // TINY/SMALL zones are far larger than any of their blocks, so the
+    // color always leaves room for the request
+    if (heap->type != LARGE) {
+        zone->offset = heap->color * CACHE_LINE_SIZE;
+        heap->color = (heap->color + 1) % ZONE_COLORS;
+    }
+
+    // Pages of a fresh mapping are not resident yet
+    init_zone_block(zone, BLOCK_PURGED);
+    return zone;
+}
+
+void unmap_zone(Zone *zone) {
+    size_t zone_size = zone->size;
+
+    PROBE3(zone_unmap, zone, zone_size, zone->type);
+    munmap(zone->base, zone_size);
+    __atomic_fetch_sub(&mapped_size, zone_size, __ATOMIC_RELAXED);
+    zone_descriptor_free(zone);
+}
+
+static bool link_zone(Heap *heap, Zone *zone) {
+    if (!pagemap_set(zone->base, zone->size, (uintptr_t)zone | zone->type)) {
+        pagemap_set(zone->base, zone->size, 0);
+        return false;
+    }
+
+    // Kept in address order for show_alloc_mem()
+    if (!heap->zones || zone->base < heap->zones->base) {
         zone->prev = NULL;
-        zone->next = base;
-        if (base) base->prev = zone;
-        base = zone;
+        zone->next = heap->zones;
+        if (heap->zones) heap->zones->prev = zone;
+        heap->zones = zone;
     } else {
-        Zone *current = base;
-        if (has_zone_cycle(current)) {
-            munmap(memory, zone_size);
-            return NULL;
-        }
+        Zone *current = heap->zones;
+        if (has_zone_cycle(current)) return false;
 
-        while (current->next && current->next < zone) {
+        while (current->next && current->next->base < zone->base) {
             current = current->next;
         }
 
@@ -251,115 +397,240 @@ static Zone *get_zone(ZoneType type, size_t size) {
         current->next = zone;
     }
 
-    Block *block = (Block *)get_zone_start(zone);
-    block->size = zone_size - sizeof(Zone);
-    block->status = FREE;
-    block->prev = NULL;
-    block->next = NULL;
-    block->free_prev = NULL;
-    block->free_next = NULL;
-    zone->blocks = block;
+    add_to_free_list(heap, zone->blocks);
+    heap->zone_count++;
 
-    add_to_free_list(zone, block);
+    stat_add(&heap->stats.mapped, zone->size);
+    stat_add(&heap->stats.zones, 1);
+    stat_add(&heap->stats.free, zone->blocks->size);
 
-    return zone;
+    return true;
+}
+
+// Only empty zones are unlinked, so their one free block leaves its bin
+static void unlink_heap_zone(Heap *heap, Zone *zone) {
+    pagemap_set(zone->base, zone->size, 0);
+    if (zone->prev) zone->prev->next = zone->next;
+    else heap->zones = zone->next;
+    if (zone->next) zone->next->prev = zone->prev;
+
+    remove_from_free_list(heap, zone->blocks);
+    if (heap->spare == zone) heap->spare = NULL;
+    heap->zone_count--;
+
+    stat_sub(&heap->stats.mapped, zone->size);
+    stat_sub(&heap->stats.zones, 1);
+    stat_sub(&heap->stats.free, zone->blocks->size);
 }
 
-static void fragment_block(Block *block, size_t size) {
-    if (!block || size < sizeof(Block)) return;
+// Answered from the descriptor, without touching the zone's pages
+static inline bool is_zone_empty(Zone *zone) {
+    return zone->blocks && !zone->live;
+}
+
+// One empty TINY/SMALL zone is kept per class so a workload hovering around
+// a zone boundary does not map and unmap on every cycle. Releasing zones
+// lowers the zone count, so the next zone of the class is mapped smaller.
+// A real-time class keeps all of them, since it can never map them again.
+static bool keep_empty_zone(Heap *heap, Zone *zone) {
+    if (heap->realtime) return true;
+    if (zone->type == LARGE) return false;
+
+    if (!heap->spare || heap->spare == zone || !is_zone_empty(heap->spare)) {
+        heap->spare = zone;
+        return true;
+    }
+    return false;
+}
+
+// Merges a free block that is not binned yet with its free neighbours,
+// then bins the result
+static void coalesce_free_blocks(Heap *heap, Zone *zone, Block *block) {
+    while (block->next && block->next->status == FREE) {
+        Block *next = block->next;
+
+        if ((char *)block + block->size != (char *)next) break;
+        remove_from_free_list(heap, next);
+
+        block->flags &= next->flags;
+        block->size += next->size;
+        block->next = next->next;
+        if (next->next) next->next->prev = block;
+    }
+
+    while (block->prev && block->prev->status == FREE) {
+        Block *prev = block->prev;
+
+        if ((char *)prev + prev->size != (char *)block) break;
+        remove_from_free_list(heap, prev);
 
-    Zone *zone = get_zone_from_block(block);
-    if (!zone) return;
+        prev->flags &= block->flags;
+        prev->size += block->size;
+        prev->next = block->next;
+        if (block->next) block->next->prev = prev;
+
+        block = prev;
+    }
+
+    add_to_free_list(heap, block);
+    PROBE3(coalesce, zone, block, block->size);
+}
+
+static void fragment_block(Heap *heap, Zone *zone, Block *block, size_t size) {
+    if (!zone || !block || size < sizeof(Block)) return;
 
     size_t aligned_size = align(size, ALIGNMENT);
     if (aligned_size > block->size) aligned_size = block->size;
 
     size_t remaining = block->size - aligned_size;
+    bool was_free = (block->status == FREE);
+    uint16_t remainder_flags = was_free ? (block->flags & BLOCK_PURGE_FLAGS) : 0;
+
+    // realloc() also shrinks allocated blocks in place, and those are not
+    // binned at all
+    if (was_free) {
+        zone->live++;
+        remove_from_free_list(heap, block);
+        stat_sub(&heap->stats.free, block->size);
+        stat_add(&heap->stats.in_use, get_block_size(block));
+        stat_add(&heap->stats.allocations, 1);
+        block->flags = 0;
+    }
+    block->status = ALLOCATED;
 
-    remove_from_free_list(zone, block);
-
+    // Too small a remainder stays part of the block, keeping blocks contiguous
     if (remaining >= sizeof(Block) + ALIGNMENT) {
         Block *new_block = (Block *)((char *)block + aligned_size);
         new_block->size = remaining;
         new_block->status = FREE;
+        new_block->flags = remainder_flags;
         new_block->next = block->next;
         new_block->prev = block;
-        new_block->free_prev = NULL;
-        new_block->free_next = NULL;
 
         if (block->next) block->next->prev = new_block;
         block->next = new_block;
+        block->size = aligned_size;
+        stat_sub(&heap->stats.in_use, remaining);
+        stat_add(&heap->stats.free, remaining);
 
-        add_to_free_list(zone, new_block);
+        coalesce_free_blocks(heap, zone, new_block);
     }
 
-    block->size = aligned_size;
-    block->status = ALLOCATED;
+    if (MALLOC_PERTURB && was_free) {
+        fill_bytes(get_block_start(block), ~(0xFF & MALLOC_PERTURB), get_block_size(block));
+    }
+    update_peak(heap);
+}
 
-    if (MALLOC_PERTURB) {
-        ft_memset(get_block_start(block), ~(0xFF & MALLOC_PERTURB), get_block_size(block));
+// Good fit in a handful of instructions: a bitmap scan for the first
+// non-empty bin that can hold size. Every block of an exact bin has the
+// same size; in a range bin blocks can be smaller than size, so only the
+// bin size falls into is walked, and any block of a later bin fits.
+static Block *get_free_block(Heap *heap, size_t size, Zone **owner) {
+    if (size > SIZE_MAX - ALIGNMENT) return NULL;
+    size = align(size, ALIGNMENT);
+    int bin = get_bin(size);
+    Block *block = NULL;
+
+    if (bin >= (int)BIN_EXACT_COUNT) {
+        block = heap->bins[bin];
+        while (block && block->size < size) block = block->free_next;
+        bin++;
     }
+    if (!block) {
+        bin = bitmap_first_set(heap->bin_map, HEAP_BIN_WORDS, bin);
+        if (bin < 0) return NULL;
+        block = heap->bins[bin];
+    }
+
+    *owner = get_entry_zone(pagemap_get(block));
+    return block;
 }
 
-static Block *get_free_block_in_zone_type(ZoneType type, size_t size) {
-    Zone *zone = base;
-    if (has_zone_cycle(zone)) return NULL;
+// Called with the lock held, once the block has been validated, so a
+// double free of a fast-binned block is caught like any other. Real-time
+// classes coalesce on every free instead: a merge of the whole fast bins
+// is a latency spike they cannot take.
+static bool fast_bin_block(Heap *heap, Block *block) {
+    if (heap->type == LARGE || heap->realtime || block->size >= BIN_EXACT_LIMIT) return false;
 
-    while (zone) {
-        if (zone->type == type && zone->size > 0) {
-            Block *block = zone->free_blocks;
-
-            while (block) {
-                void *zone_start = get_zone_start(zone);
-                void *zone_end = (char *)zone + zone->size;
-
-                if ((void *)block < zone_start || (void *)block >= zone_end ||
-                    block->size < sizeof(Block) || block->size > zone->size) {
-                    break;
-                }
-
-                if (block->status == FREE && block->size >= size) {
-                    return block;
-                }
-                block = block->free_next;
-            }
-        }
-        zone = zone->next;
+    int bin = get_bin(block->size);
+    block->status = CACHED;
+    block->flags = 0;
+    block->free_prev = NULL;
+    stat_sub(&heap->stats.in_use, get_block_size(block));
+    stat_add(&heap->stats.free, block->size);
+    stat_add(&heap->stats.frees, 1);
+
+    if (MALLOC_PERTURB) {
+        fill_bytes(get_block_start(block), 0xFF & MALLOC_PERTURB, get_block_size(block));
     }
-    return NULL;
-}
 
-static void coalesce_free_blocks(Zone *zone, Block *block) {
-    if (!zone || !block || block->status != FREE) return;
+    block->free_next = heap->fast[bin];
+    heap->fast[bin] = block;
+    bitmap_set(heap->fast_map, bin);
+    heap->fast_bytes += block->size;
+    return true;
+}
 
-    while (block->next && block->next->status == FREE) {
-        Block *next = block->next;
+static Block *take_fast_block(Heap *heap, size_t total_size) {
+    size_t size = align(total_size, ALIGNMENT);
+    if (size >= BIN_EXACT_LIMIT) return NULL;
 
-        if ((char *)block + block->size == (char *)next) {
-            remove_from_free_list(zone, next);
+    int bin = get_bin(size);
+    Block *block = heap->fast[bin];
+    if (!block) return NULL;
 
-            block->size += next->size;
-            block->next = next->next;
-            if (next->next) next->next->prev = block;
-        } else {
-            break;
-        }
-    }
+    heap->fast[bin] = block->free_next;
+    if (!heap->fast[bin]) bitmap_clear(heap->fast_map, bin);
+    heap->fast_bytes -= block->size;
 
-    while (block->prev && block->prev->status == FREE) {
-        Block *prev = block->prev;
+    block->status = ALLOCATED;
+    block->free_next = NULL;
+    stat_sub(&heap->stats.free, block->size);
+    stat_add(&heap->stats.in_use, get_block_size(block));
+    stat_add(&heap->stats.allocations, 1);
 
-        if ((char *)prev + prev->size == (char *)block) {
-            remove_from_free_list(zone, block);
+    if (MALLOC_PERTURB) {
+        fill_bytes(get_block_start(block), ~(0xFF & MALLOC_PERTURB), get_block_size(block));
+    }
+    update_peak(heap);
+    return block;
+}
 
-            prev->size += block->size;
-            prev->next = block->next;
-            if (block->next) block->next->prev = prev;
+// Merges every fast-binned block back into the heap. With released, zones
+// left empty and not kept are unlinked onto it, for the caller to unmap
+// once the lock is dropped; without it they stay linked.
+static void consolidate_fast_bins(Heap *heap, Zone **released) {
+    for (int bin = bitmap_first_set(heap->fast_map, FAST_BIN_WORDS, 0); bin >= 0;
+         bin = bitmap_first_set(heap->fast_map, FAST_BIN_WORDS, bin + 1)) {
+        Block *block = heap->fast[bin];
 
-            block = prev;
-        } else {
-            break;
+        while (block) {
+            Block *next = block->free_next;
+            Zone *zone = get_entry_zone(pagemap_get(block));
+
+            block->status = FREE;
+            zone->live--;
+            coalesce_free_blocks(heap, zone, block);
+            if (released && is_zone_empty(zone) && !keep_empty_zone(heap, zone)) {
+                unlink_heap_zone(heap, zone);
+                zone->next = *released;
+                *released = zone;
+            }
+            block = next;
         }
+        heap->fast[bin] = NULL;
+        bitmap_clear(heap->fast_map, bin);
+    }
+    heap->fast_bytes = 0;
+}
+
+static void unmap_zones(Zone *zone) {
+    while (zone) {
+        Zone *next = zone->next;
+        unmap_zone(zone);
+        zone = next;
     }
 }
 
@@ -391,15 +662,16 @@ static void print_hex_dump(void *ptr, size_t size) {
     }
 }
 
-static void show_alloc_zone(Zone *zone, bool hex) {
-    if (!zone) return;
+static size_t show_alloc_zone(Zone *zone, bool hex) {
+    if (!zone) return 0;
 
     ft_printf("%s : %p\n", get_zone_type_str(zone->type), get_zone_start(zone));
     Block *block = zone->blocks;
+    size_t total = 0;
 
     if (has_block_cycle(block)) {
         ft_printf("Error: Corrupted block list detected\n");
-        return;
+        return 0;
     }
 
     while (block) {
@@ -407,99 +679,388 @@ static void show_alloc_zone(Zone *zone, bool hex) {
             void *start = get_block_start(block);
             size_t size = get_block_size(block);
             ft_printf("%p -> %p : %z bytes\n", start, (char *)start + size, size);
+            total += size;
 
             if (hex) print_hex_dump(start, size);
         }
         block = block->next;
     }
+    return total;
+}
+
+// Each class is printed under its own lock, so the report is consistent per
+// class while allocations in other classes carry on.
+static void show_alloc_heaps(bool hex) {
+    size_t total = 0;
+
+    for (int type = TINY; type <= LARGE; type++) {
+        Heap *heap = &heaps[type];
+        if (!is_heap_ready(heap)) continue;
+
+        lock_heap(heap);
+        if (has_zone_cycle(heap->zones)) {
+            ft_printf("Error: Corrupted zone list detected\n");
+            unlock_heap(heap);
+            continue;
+        }
+
+        Zone *zone = heap->zones;
+        while (zone) {
+            total += show_alloc_zone(zone, hex);
+            zone = zone->next;
+        }
+        unlock_heap(heap);
+    }
+    ft_printf("Total : %z bytes\n", total);
 }
 
 void show_alloc_mem(void) {
-    lock_malloc();
+    show_alloc_heaps(false);
+}
 
-    if (has_zone_cycle(base)) {
-        ft_printf("Error: Corrupted zone list detected\n");
-        unlock_malloc();
-        return;
+void show_alloc_mem_ex(void) {
+    show_alloc_heaps(true);
+}
+
+_Static_assert(CACHE_BINS == (TINY_BLOCK_MAX_SIZE - sizeof(Block) - ALIGNMENT) / ALIGNMENT + 1,
+               "one cache bin per TINY block size");
+
+static inline int get_cache_bin(size_t block_size) {
+    size_t bin = (block_size - sizeof(Block) - ALIGNMENT) / ALIGNMENT;
+    return (bin < CACHE_BINS) ? (int)bin : CACHE_BINS - 1;
+}
+
+// Moves the blocks a thread handed out from its cache into the TINY stats.
+// Called with the TINY lock held.
+static void fold_cache_stats(Heap *heap, ThreadCache *cache) {
+    size_t allocations = cache->allocations;
+    size_t bytes = cache->bytes;
+    if (!allocations) return;
+
+    stat_add(&heap->stats.allocations, allocations);
+    stat_add(&heap->stats.in_use, bytes - allocations * sizeof(Block));
+    stat_sub(&heap->stats.free, bytes);
+    update_peak(heap);
+    __atomic_store_n(&cache->allocations, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&cache->bytes, 0, __ATOMIC_RELAXED);
+}
+
+// A bin holds blocks at least as large as its size, so the first one fits.
+// Runs without the lock, so the header is left CACHED; see is_cached_live().
+static void *allocate_cached(ThreadCache *cache, size_t size, size_t total_size) {
+    int bin = get_cache_bin(align(total_size, ALIGNMENT));
+    Block *block = cache->bins[bin];
+    if (!block) return NULL;
+
+    cache->bins[bin] = block->free_next;
+    cache->counts[bin]--;
+    __atomic_store_n(&cache->allocations, cache->allocations + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&cache->bytes, cache->bytes + block->size, __ATOMIC_RELAXED);
+
+    void *result = get_block_start(block);
+    bool sampled = prof_enabled() && prof_should_sample(size);
+    block->free_prev = (Block *)((uintptr_t)block | (sampled ? CACHED_LIVE_SAMPLED : 0));
+
+    if (MALLOC_PERTURB) {
+        fill_bytes(result, ~(0xFF & MALLOC_PERTURB), get_block_size(block));
     }
+    if (sampled) prof_track(result, size);
+    return result;
+}
 
-    Zone *zone = base;
-    while (zone) {
-        show_alloc_zone(zone, false);
-        zone = zone->next;
+// Called with the TINY lock held, once the block has been validated, so a
+// double free of a cached block is caught like any other
+static bool cache_block(Heap *heap, ThreadCache *cache, Block *block) {
+    int bin = get_cache_bin(block->size);
+    if (cache->counts[bin] >= CACHE_BIN_MAX) return false;
+
+    fold_cache_stats(heap, cache);
+    block->status = CACHED;
+    block->flags = 0;
+    block->free_prev = NULL;
+    stat_sub(&heap->stats.in_use, get_block_size(block));
+    stat_add(&heap->stats.free, block->size);
+    stat_add(&heap->stats.frees, 1);
+
+    if (MALLOC_PERTURB) {
+        fill_bytes(get_block_start(block), 0xFF & MALLOC_PERTURB, get_block_size(block));
     }
-    ft_printf("Total : %z bytes\n", get_alloc_blocks_size());
-    unlock_malloc();
+
+    block->free_next = cache->bins[bin];
+    cache->bins[bin] = block;
+    cache->counts[bin]++;
+    return true;
 }
 
-void show_alloc_mem_ex(void) {
-    lock_malloc();
+// Returns every cached block to its zone, along with the TINY fast bins,
+// releasing zones that become empty just like free() would
+void cache_flush(ThreadCache *cache) {
+    Heap *heap = &heaps[TINY];
+    Zone *released = NULL;
 
-    if (has_zone_cycle(base)) {
-        ft_printf("Error: Corrupted zone list detected\n");
-        unlock_malloc();
-        return;
+    lock_heap(heap);
+    fold_cache_stats(heap, cache);
+
+    // What is left of the run goes back along with the cached blocks
+    if (cache->run) {
+        cache->run->free_next = cache->bins[0];
+        cache->bins[0] = cache->run;
+        cache->run = NULL;
     }
+    for (int bin = 0; bin < CACHE_BINS; bin++) {
+        Block *block = cache->bins[bin];
 
-    Zone *zone = base;
-    while (zone) {
-        show_alloc_zone(zone, true);
-        zone = zone->next;
+        while (block) {
+            Block *next = block->free_next;
+            Zone *zone = get_entry_zone(pagemap_get(block));
+
+            block->status = FREE;
+            block->flags = 0;
+            zone->live--;
+            coalesce_free_blocks(heap, zone, block);
+            if (is_zone_empty(zone) && !keep_empty_zone(heap, zone)) {
+                unlink_heap_zone(heap, zone);
+                zone->next = released;
+                released = zone;
+            }
+            block = next;
+        }
+        cache->bins[bin] = NULL;
+        cache->counts[bin] = 0;
     }
-    ft_printf("Total : %z bytes\n", get_alloc_blocks_size());
-    unlock_malloc();
+    consolidate_fast_bins(heap, &released);
+    unlock_heap(heap);
+    unmap_zones(released);
 }
 
-void *malloc(size_t size) {
-    if (!size) return NULL;
+static inline size_t get_flags_alignment(int flags) {
+    return (size_t)1 << (flags & MALLOCX_LG_ALIGN_MASK);
+}
 
-    lock_malloc();
+// Set by reallocate() on the allocate() and release() it makes, so a moved
+// realloc is timed once, as a realloc, and not also as a malloc and a free
+#define ALLOC_NESTED (1 << 30)
+
+static inline void record_latency(LatencyOp op, int type, uint64_t start, int flags) {
+    if (!(flags & ALLOC_NESTED)) latency_record(op, type, start);
+}
+
+// Splits the bytes in front of at off a free block as a free block of their
+// own, so there must be enough of them to hold one; the caller reserves
+// room for that. Returns the block at at, still free and listed.
+static Block *split_free_block(Heap *heap, Block *block, Block *at) {
+    size_t gap = (size_t)((char *)at - (char *)block);
+
+    at->size = block->size - gap;
+    at->status = FREE;
+    at->flags = block->flags;
+    at->prev = block;
+    at->next = block->next;
+    at->free_prev = NULL;
+    at->free_next = NULL;
+
+    remove_from_free_list(heap, block);
+    if (block->next) block->next->prev = at;
+    block->next = at;
+    block->size = gap;
+
+    add_to_free_list(heap, block);
+    add_to_free_list(heap, at);
+    return at;
+}
+
+static Block *align_free_block(Heap *heap, Block *block, size_t alignment) {
+    uintptr_t start = (uintptr_t)get_block_start(block);
+    uintptr_t payload = align(start, alignment);
+
+    if (payload != start && payload - start < sizeof(Block) + ALIGNMENT) {
+        payload = align(start + sizeof(Block) + ALIGNMENT, alignment);
+    }
+    if (payload == start) return block;
+    return split_free_block(heap, block, (Block *)(payload - sizeof(Block)));
+}
+
+// Takes a new run for a thread cache from the TINY heap. Returns NULL when
+// no free block has room for one, and the allocation then takes the usual
+// path, which maps a zone if need be.
+static Block *carve_run(Heap *heap) {
+    Zone *zone = NULL;
+    Block *block = get_free_block(heap, CACHE_RUN_SIZE + CACHE_LINE_SIZE + sizeof(Block), &zone);
+    if (!block) return NULL;
+
+    uintptr_t start = align((uintptr_t)block, CACHE_LINE_SIZE);
+    if (start != (uintptr_t)block && start - (uintptr_t)block < sizeof(Block) + ALIGNMENT) {
+        start += CACHE_LINE_SIZE;
+    }
+    if (start != (uintptr_t)block) block = split_free_block(heap, block, (Block *)start);
+
+    fragment_block(heap, zone, block, CACHE_RUN_SIZE);
+    block->status = CACHED;
+    block->free_prev = NULL;
+    stat_sub(&heap->stats.in_use, get_block_size(block));
+    stat_add(&heap->stats.free, block->size);
+    stat_sub(&heap->stats.allocations, 1);
+    return block;
+}
+
+// Carves the front of the thread's run, taking a new run when what is left
+// is too small; the old remainder goes back to the heap. Called with the
+// TINY lock held.
+static Block *take_from_run(Heap *heap, ThreadCache *cache, size_t total_size) {
+    size_t size = align(total_size, ALIGNMENT);
+    Block *block = cache->run;
+
+    if (block && block->size < size) {
+        Zone *zone = get_entry_zone(pagemap_get(block));
+
+        block->status = FREE;
+        block->flags = 0;
+        zone->live--;
+        coalesce_free_blocks(heap, zone, block);
+        block = NULL;
+    }
+    if (!block) block = carve_run(heap);
+    cache->run = NULL;
+    if (!block) return NULL;
+
+    if (block->size - size >= sizeof(Block) + ALIGNMENT) {
+        Block *rest = (Block *)((char *)block + size);
+        rest->size = block->size - size;
+        rest->status = CACHED;
+        rest->flags = 0;
+        rest->prev = block;
+        rest->next = block->next;
+        rest->free_prev = NULL;
+        rest->free_next = NULL;
+
+        if (block->next) block->next->prev = rest;
+        block->next = rest;
+        block->size = size;
+        cache->run = rest;
+        get_entry_zone(pagemap_get(block))->live++;
+    }
+
+    block->status = ALLOCATED;
+    block->flags = 0;
+    stat_sub(&heap->stats.free, block->size);
+    stat_add(&heap->stats.in_use, get_block_size(block));
+    stat_add(&heap->stats.allocations, 1);
+
+    if (MALLOC_PERTURB) {
+        fill_bytes(get_block_start(block), ~(0xFF & MALLOC_PERTURB), get_block_size(block));
+    }
+    return block;
+}
+
+// Alignments up to ALIGNMENT come for free. Larger ones search for a block
+// with room to align inside it, and skip the thread cache. Zeroing is
+// skipped for blocks carved from a zone mapped for this call, whose pages
+// the kernel has just zeroed.
+static void *allocate(size_t size, size_t alignment, int flags) {
+    if (!size) return NULL;
 
     size_t total_size = size + sizeof(Block);
-    if (total_size < size) { // Overflow check
-        unlock_malloc();
+    size_t search_size = total_size;
+    if (alignment > ALIGNMENT) search_size += alignment + sizeof(Block) + ALIGNMENT;
+    if (total_size < size || search_size < total_size) { // Overflow check
         errno = ENOMEM;
         return NULL;
     }
 
-    ZoneType type = get_zone_type(total_size);
-    Block *block = get_free_block_in_zone_type(type, total_size);
+    uint64_t start = latency_start();
+    ZoneType type = get_zone_type(search_size);
+    Heap *heap = get_heap(type);
+    Zone *zone = NULL;
+    bool fresh = false;
+    ThreadCache *cache = NULL;
 
-    if (block) {
-        fragment_block(block, total_size);
-        void *result = get_block_start(block);
-        unlock_malloc();
-        return result;
+    if (type == TINY && alignment <= ALIGNMENT && !(flags & MALLOCX_NO_CACHE)) {
+        cache = cache_get();
+        void *result = cache ? allocate_cached(cache, size, total_size) : NULL;
+
+        if (result) {
+            if (flags & MALLOCX_ZERO) {
+                fill_bytes(result, 0, get_block_size((Block *)((char *)result - sizeof(Block))));
+            }
+            record_latency(LATENCY_MALLOC, type, start, flags);
+            return result;
+        }
     }
 
-    Zone *zone = get_zone(type, total_size);
-    if (!zone) {
+    lock_heap(heap);
+    Block *block = cache ? take_from_run(heap, cache, total_size) : NULL;
+    if (!block && alignment <= ALIGNMENT) block = take_fast_block(heap, total_size);
+    if (block) zone = get_entry_zone(pagemap_get(block));
+    else block = get_free_block(heap, search_size, &zone);
+
+    // The fast bins are only merged once nothing else fits; zones they
+    // leave empty are about to be used
+    if (!block && heap->fast_bytes) {
+        consolidate_fast_bins(heap, NULL);
+        block = get_free_block(heap, search_size, &zone);
+    }
+
+    if (!block && heap->realtime) {
+        stat_add(&heap->stats.exhausted, 1);
+        unlock_heap(heap);
         errno = ENOMEM;
-        unlock_malloc();
         return NULL;
     }
+    if (!block) {
+        // A LARGE zone is sized for this request alone, so its mmap does not
+        // need to hold up other LARGE allocations
+        if (type == LARGE) {
+            unlock_heap(heap);
+            zone = map_zone(heap, search_size);
+            lock_heap(heap);
+        } else {
+            zone = map_zone(heap, search_size);
+        }
 
-    block = zone->blocks;
-    if (block->status == FREE && block->size >= total_size) {
-        fragment_block(block, total_size);
-        void *result = get_block_start(block);
-        unlock_malloc();
-        return result;
+        if (!zone) {
+            unlock_heap(heap);
+            errno = ENOMEM;
+            return NULL;
+        }
+        if (!link_zone(heap, zone)) {
+            unlock_heap(heap);
+            unmap_zone(zone);
+            errno = ENOMEM;
+            return NULL;
+        }
+        block = zone->blocks;
+        fresh = true;
     }
 
-    errno = ENOMEM;
-    unlock_malloc();
-    return NULL;
+    if (alignment > ALIGNMENT) block = align_free_block(heap, block, alignment);
+    fragment_block(heap, zone, block, total_size);
+    set_slack(block, size);
+    void *result = get_block_start(block);
+    size_t usable_size = get_block_size(block);
+
+    bool sampled = prof_enabled() && prof_should_sample(size);
+    if (sampled) block->flags |= BLOCK_SAMPLED;
+
+    unlock_heap(heap);
+    if ((flags & MALLOCX_ZERO) && (!fresh || MALLOC_PERTURB)) fill_bytes(result, 0, usable_size);
+    if (sampled) prof_track(result, size);
+    record_latency(LATENCY_MALLOC, type, start, flags);
+    return result;
 }
 
-void free(void *ptr) {
+static void release(void *ptr, int flags) {
     if (!ptr) return;
 
-    lock_malloc();
-
-    Block *block = get_block_from_ptr(ptr);
+    // Only TINY blocks are cached, so no other class creates a cache. The
+    // unlocked page map read is a hint; the zone type is checked again below.
+    uint64_t start = latency_start();
+    uintptr_t entry = pagemap_get(ptr);
+    ThreadCache *cache = NULL;
+    if (entry && (entry & PAGEMAP_TYPE_MASK) == TINY && !(flags & MALLOCX_NO_CACHE)) cache = cache_get();
+    Heap *heap = NULL;
+    Zone *zone = NULL;
+    Block *block = get_block_from_ptr(ptr, &heap, &zone);
     if (!block) {
-        unlock_malloc();
         if ((MALLOC_CHECK >> 2) & 1) {
             ft_printf("free(): Invalid pointer: %p\n", ptr);
         } else if (MALLOC_CHECK & 1) {
@@ -510,100 +1071,651 @@ void free(void *ptr) {
     }
 
     if (block->status != ALLOCATED) {
+        unlock_heap(heap);
         if ((MALLOC_CHECK >> 2) & 1) {
             ft_printf("free(): Double free: %p\n", ptr);
         } else if (MALLOC_CHECK & 1) {
             ft_printf("free(): Double free\n");
         }
         if ((MALLOC_CHECK >> 1) & 1) abort();
-        unlock_malloc();
         return;
     }
 
-    Zone *zone = get_zone_from_block(block);
-    if (!zone) {
-        unlock_malloc();
+    // Untracked before the block can be reused, so a new sample at the same
+    // address is never dropped by mistake
+    if (block->flags & BLOCK_SAMPLED) prof_untrack(ptr);
+
+    if (zone->type == TINY && cache && cache_block(heap, cache, block)) {
+        unlock_heap(heap);
+        record_latency(LATENCY_FREE, TINY, start, flags);
         return;
     }
 
-    block->status = FREE;
-    if (MALLOC_PERTURB) {
-        ft_memset(get_block_start(block), 0xFF & MALLOC_PERTURB,
-                  get_block_size(block));
+    ZoneType type = zone->type;
+    Zone *released = NULL;
+
+    if (fast_bin_block(heap, block)) {
+        if (heap->fast_bytes > FAST_BIN_MAX_BYTES) consolidate_fast_bins(heap, &released);
+    } else {
+        block->status = FREE;
+        block->flags = 0;
+        zone->live--;
+        stat_sub(&heap->stats.in_use, get_block_size(block));
+        stat_add(&heap->stats.free, block->size);
+        stat_add(&heap->stats.frees, 1);
+
+        if (MALLOC_PERTURB) {
+            fill_bytes(get_block_start(block), 0xFF & MALLOC_PERTURB,
+                       get_block_size(block));
+        }
+
+        coalesce_free_blocks(heap, zone, block);
+
+        if (is_zone_empty(zone) && !keep_empty_zone(heap, zone)) {
+            unlink_heap_zone(heap, zone);
+            zone->next = released;
+            released = zone;
+        }
     }
 
-    add_to_free_list(zone, block);
-    coalesce_free_blocks(zone, block);
+    unlock_heap(heap);
+    unmap_zones(released);
+    record_latency(LATENCY_FREE, type, start, flags);
+}
 
-    unlock_malloc();
+// Resizes an allocated block in place to hold between min_size and
+// max_size bytes, taking in the free block after it when it has to grow.
+// The block keeps its class, so it only gets as large as the class allows.
+// Called with the lock held; returns false, leaving the block as it was,
+// when even min_size does not fit.
+static bool resize_block(Heap *heap, Zone *zone, Block *block, size_t min_size, size_t max_size) {
+    size_t min_total = align(min_size + sizeof(Block), ALIGNMENT);
+    if (min_total < min_size || get_zone_type(min_total) != zone->type) return false;
+
+    size_t max_total = (max_size > SIZE_MAX - sizeof(Block) - ALIGNMENT) ? SIZE_MAX & ~(size_t)(ALIGNMENT - 1)
+                                                                          : align(max_size + sizeof(Block), ALIGNMENT);
+    size_t class_max = (zone->type == TINY) ? TINY_BLOCK_MAX_SIZE :
+                       (zone->type == SMALL) ? SMALL_BLOCK_MAX_SIZE : max_total;
+    if (max_total > class_max) max_total = class_max;
+
+    Block *next = block->next;
+    bool can_merge = next && next->status == FREE;
+    size_t available = block->size + (can_merge ? next->size : 0);
+    if (available < min_total) return false;
+
+    size_t target = (max_total < available) ? max_total : available;
+    if (target < min_total) target = min_total;
+
+    if (target > block->size) {
+        remove_from_free_list(heap, next);
+        stat_sub(&heap->stats.free, next->size);
+        stat_add(&heap->stats.in_use, next->size);
+
+        block->size += next->size;
+        block->next = next->next;
+        if (next->next) next->next->prev = block;
+    }
+    if (block->size - target >= sizeof(Block) + ALIGNMENT) {
+        fragment_block(heap, zone, block, target);
+    }
+    update_peak(heap);
+    return true;
 }
 
-void *realloc(void *ptr, size_t size) {
-    if (!ptr) return malloc(size);
+static inline void trace_realloc(size_t size, void *result, void *ptr) {
+    if (trace_enabled()) trace_record(TRACE_REALLOC, size, result, ptr);
+}
+
+// A block grows in place when the free block after it has the room, and
+// only moves otherwise, or when it is not aligned as flags ask. The call is
+// traced before the old block is released, so no other thread can be handed
+// its address with an earlier timestamp.
+static void *reallocate(void *ptr, size_t size, int flags) {
+    size_t alignment = get_flags_alignment(flags);
+
+    if (!ptr) {
+        void *result = allocate(size, alignment, flags);
+        trace_realloc(size, result, ptr);
+        return result;
+    }
     if (!size) {
-        free(ptr);
+        trace_realloc(size, NULL, ptr);
+        release(ptr, flags);
         return NULL;
     }
 
-    lock_malloc();
-
-    Block *block = get_block_from_ptr(ptr);
-    if (!block || block->status != ALLOCATED) {
+    uint64_t start = latency_start();
+    Heap *heap = NULL;
+    Zone *zone = NULL;
+    Block *block = get_block_from_ptr(ptr, &heap, &zone);
+    if (!block) {
+        trace_realloc(size, NULL, ptr);
+        errno = EINVAL;
+        return NULL;
+    }
+    if (block->status != ALLOCATED) {
+        unlock_heap(heap);
+        trace_realloc(size, NULL, ptr);
         errno = EINVAL;
-        unlock_malloc();
         return NULL;
     }
 
-    size_t new_total_size = align(size + sizeof(Block), ALIGNMENT);
     size_t current_user_size = get_block_size(block);
+    ZoneType new_type = get_zone_type(align(size + sizeof(Block), ALIGNMENT));
 
-    ZoneType new_type = get_zone_type(new_total_size);
-    Zone *current_zone = get_zone_from_block(block);
-    ZoneType current_type = current_zone ? current_zone->type : LARGE;
+    if ((uintptr_t)ptr % alignment == 0 && resize_block(heap, zone, block, size, size)) {
+        size_t new_user_size = get_block_size(block);
 
-    if (new_type == current_type && block->size >= new_total_size) {
-        if (block->size - new_total_size >= sizeof(Block) + ALIGNMENT) {
-            fragment_block(block, new_total_size);
+        set_slack(block, size);
+        unlock_heap(heap);
+        if ((flags & MALLOCX_ZERO) && new_user_size > current_user_size) {
+            fill_bytes((char *)ptr + current_user_size, 0, new_user_size - current_user_size);
         }
-        unlock_malloc();
+        latency_record(LATENCY_REALLOC, new_type, start);
+        trace_realloc(size, ptr, ptr);
         return ptr;
     }
 
-    unlock_malloc();
+    unlock_heap(heap);
 
-    void *new_ptr = malloc(size);
+    void *new_ptr = allocate(size, alignment, flags | ALLOC_NESTED);
     if (!new_ptr) {
+        trace_realloc(size, NULL, ptr);
         errno = ENOMEM;
         return NULL;
     }
 
     size_t copy_size = (current_user_size < size) ? current_user_size : size;
-    ft_memcpy(new_ptr, ptr, copy_size);
-    free(ptr);
+    copy_bytes(new_ptr, ptr, copy_size);
+    trace_realloc(size, new_ptr, ptr);
+    release(ptr, flags | ALLOC_NESTED);
 
+    latency_record(LATENCY_REALLOC, new_type, start);
     return new_ptr;
 }
 
-__attribute__((constructor))
-static void init(void) {
-    lock_malloc();
-    get_zone(TINY, 0);
-    get_zone(SMALL, 0);
-    unlock_malloc();
+static void *allocate_traced(size_t size, size_t alignment, int flags) {
+    PROBE1(malloc_entry, size);
+    void *result = allocate(size, alignment, flags);
+
+    if (trace_enabled()) trace_record(TRACE_MALLOC, size, result, NULL);
+    PROBE2(malloc_return, result, size);
+    return result;
+}
+
+void *malloc(size_t size) {
+    return allocate_traced(size, ALIGNMENT, 0);
+}
+
+// The C library allocates thread control data with calloc() and releases it
+// with free(), so calloc() has to come from this allocator too: otherwise
+// every exiting thread leaks a block free() cannot recognise
+void *calloc(size_t count, size_t size) {
+    if (size && count > SIZE_MAX / size) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    return allocate_traced(count * size, ALIGNMENT, MALLOCX_ZERO);
+}
+
+static inline bool is_power_of_two(size_t value) {
+    return value && !(value & (value - 1));
+}
+
+// Like the C library's, these must come from this allocator so that free()
+// recognises what they return
+void *aligned_alloc(size_t alignment, size_t size) {
+    if (!is_power_of_two(alignment)) {
+        errno = EINVAL;
+        return NULL;
+    }
+    return allocate_traced(size, alignment, 0);
+}
+
+void *memalign(size_t alignment, size_t size) {
+    return aligned_alloc(alignment, size);
+}
+
+void *valloc(size_t size) {
+    return allocate_traced(size, get_os_page_size(), 0);
+}
+
+int posix_memalign(void **memptr, size_t alignment, size_t size) {
+    if (!is_power_of_two(alignment) || alignment % sizeof(void *)) return EINVAL;
+
+    void *result = allocate_traced(size, alignment, 0);
+    if (!result && size) return ENOMEM;
+    *memptr = result;
+    return 0;
+}
+
+// Lock-free: a live block's size only changes through realloc() on that
+// same pointer, and its zone stays mapped while it lives
+size_t malloc_usable_size(void *ptr) {
+    uintptr_t entry = pagemap_get(ptr);
+    if (!entry) return 0;
+
+    Block *block = (Block *)((char *)ptr - sizeof(Block));
+    if ((char *)block < (char *)get_zone_start(get_entry_zone(entry)) || (uintptr_t)ptr % ALIGNMENT ||
+        (block->status != ALLOCATED && !is_cached_live(block))) {
+        return 0;
+    }
+    return get_block_size(block);
+}
+
+// True for any address inside a TINY, SMALL or LARGE zone. Never touches the
+// pointed-to memory, so it is safe on pointers from other allocators.
+bool ft_malloc_owns(const void *ptr) {
+    return pagemap_get(ptr) != 0;
+}
+
+// Recorded before the block is released, so no other thread can be handed
+// the same address with an earlier timestamp
+void free(void *ptr) {
+    PROBE1(free_entry, ptr);
+    if (ptr && trace_enabled()) trace_record(TRACE_FREE, 0, ptr, NULL);
+    release(ptr, 0);
+    PROBE1(free_return, ptr);
+}
+
+void *realloc(void *ptr, size_t size) {
+    PROBE2(realloc_entry, ptr, size);
+    void *result = reallocate(ptr, size, 0);
+    PROBE3(realloc_return, result, ptr, size);
+    return result;
+}
+
+// Arena allocations are not traced: they are never freed one by one, so a
+// replay could not match them
+void *mallocx(size_t size, int flags) {
+    unsigned arena_flag = (unsigned)(flags & MALLOCX_ARENA_MASK) >> MALLOCX_ARENA_SHIFT;
+    if (!arena_flag) return allocate_traced(size, get_flags_alignment(flags), flags);
+
+    return arena_alloc_indexed(arena_flag - 1, size, get_flags_alignment(flags), flags & MALLOCX_ZERO);
+}
+
+void *rallocx(void *ptr, size_t size, int flags) {
+    if (flags & MALLOCX_ARENA_MASK) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    PROBE2(realloc_entry, ptr, size);
+    void *result = reallocate(ptr, size, flags);
+    PROBE3(realloc_return, result, ptr, size);
+    return result;
+}
+
+// Resizes in place only, to size + extra bytes if there is room and to at
+// least size otherwise. Returns the usable size the block ends up with,
+// which is below size when it could not grow that far, and 0 for pointers
+// that are not live blocks.
+size_t xallocx(void *ptr, size_t size, size_t extra, int flags) {
+    if (!ptr || !size) return 0;
+
+    Heap *heap = NULL;
+    Zone *zone = NULL;
+    Block *block = get_block_from_ptr(ptr, &heap, &zone);
+    if (!block) return 0;
+    if (block->status != ALLOCATED) {
+        unlock_heap(heap);
+        return 0;
+    }
+
+    size_t old_size = get_block_size(block);
+    size_t max_size = (extra > SIZE_MAX - size) ? SIZE_MAX : size + extra;
+    bool resized = (uintptr_t)ptr % get_flags_alignment(flags) == 0 &&
+                   resize_block(heap, zone, block, size, max_size);
+    size_t new_size = get_block_size(block);
+
+    if (resized) set_slack(block, (max_size < new_size) ? max_size : new_size);
+    unlock_heap(heap);
+
+    if ((flags & MALLOCX_ZERO) && new_size > old_size) {
+        fill_bytes((char *)ptr + old_size, 0, new_size - old_size);
+    }
+    if (resized && trace_enabled()) trace_record(TRACE_REALLOC, new_size, ptr, ptr);
+    return new_size;
+}
+
+size_t sallocx(const void *ptr, int flags) {
+    (void)flags;
+    return malloc_usable_size((void *)ptr);
+}
+
+void dallocx(void *ptr, int flags) {
+    PROBE1(free_entry, ptr);
+    if (ptr && trace_enabled()) trace_record(TRACE_FREE, 0, ptr, NULL);
+    release(ptr, flags);
+    PROBE1(free_return, ptr);
 }
 
-__attribute__((destructor))
-static void clean(void) {
-    lock_malloc();
-    if (!has_zone_cycle(base)) {
-      Zone *next = NULL;
-      while (base) {
-            next = base->next;
-            munmap(base, base->size);
-            base = next;
+// The payload mallocx() guarantees for size; a block may hold a little more
+// when the remainder of the block it was cut from was too small to split.
+// Returns 0 when the size cannot be allocated at all.
+size_t nallocx(size_t size, int flags) {
+    size_t granule = (flags & MALLOCX_ARENA_MASK) ? ARENA_ALIGNMENT : ALIGNMENT;
+    size_t header = (flags & MALLOCX_ARENA_MASK) ? 0 : sizeof(Block);
+
+    if (!size || size > SIZE_MAX - header - granule) return 0;
+    return align(size + header, granule) - header;
+}
+
+// Returns the whole pages inside a free block to the kernel, keeping its
+// header page. The block must stay free and locked while its pages go, since
+// an allocation racing with MADV_DONTNEED would see its writes zeroed.
+static size_t purge_block(Block *block) {
+    size_t page_size = get_os_page_size();
+    uintptr_t start = align((uintptr_t)block + sizeof(Block), page_size);
+    uintptr_t end = ((uintptr_t)block + block->size) & ~(uintptr_t)(page_size - 1);
+
+    block->flags |= BLOCK_PURGED;
+    if (end <= start || madvise((void *)start, end - start, MADV_DONTNEED) != 0) return 0;
+    return end - start;
+}
+
+// Purges the free blocks of one class and releases its spare empty zone,
+// leaving the first *pad free bytes it meets resident. With decay, only
+// blocks that were already free at the previous pass are purged and the
+// others are marked for the next one, so memory is returned between one and
+// two passes after it was freed.
+static size_t purge_heap(Heap *heap, bool decay, size_t *pad) {
+    size_t purged = 0;
+    Zone *released = NULL;
+
+    lock_heap(heap);
+    if (heap->realtime) {
+        unlock_heap(heap);
+        return 0;
+    }
+    consolidate_fast_bins(heap, &released);
+    Zone *spare = heap->spare;
+    if (spare && is_zone_empty(spare)) {
+        if (*pad >= spare->size) {
+            *pad -= spare->size;
+        } else if (!decay || (spare->blocks->flags & BLOCK_AGED)) {
+            unlink_heap_zone(heap, spare);
+            spare->next = released;
+            released = spare;
+        } else {
+            spare->blocks->flags |= BLOCK_AGED;
         }
     }
-    base = NULL;
-    unlock_malloc();
-    pthread_mutex_destroy(&malloc_mutex);
+
+    spare = heap->spare;
+    for (int bin = bitmap_first_set(heap->bin_map, HEAP_BIN_WORDS, 0); bin >= 0;
+         bin = bitmap_first_set(heap->bin_map, HEAP_BIN_WORDS, bin + 1)) {
+        for (Block *block = heap->bins[bin]; block; block = block->free_next) {
+            if (block->flags & BLOCK_PURGED) continue;
+            if (spare && block == spare->blocks && is_zone_empty(spare)) continue;
+            if (decay && !(block->flags & BLOCK_AGED)) {
+                block->flags |= BLOCK_AGED;
+            } else if (*pad >= block->size) {
+                *pad -= block->size;
+            } else {
+                purged += purge_block(block);
+            }
+        }
+    }
+    unlock_heap(heap);
+
+    for (Zone *zone = released; zone; zone = zone->next) purged += zone->size;
+    unmap_zones(released);
+    return purged;
+}
+
+// Returns the number of bytes handed back to the kernel
+// Real-time classes are left alone: purged pages would fault back in on
+// their allocation path. That is checked under the class lock, so a pass
+// racing with malloc_reserve() cannot purge a class that just switched.
+size_t purge_heaps(size_t pad, bool decay) {
+    size_t purged = 0;
+
+    for (int type = TINY; type < LARGE; type++) {
+        Heap *heap = &heaps[type];
+
+        if (is_heap_ready(heap)) purged += purge_heap(heap, decay, &pad);
+    }
+    return purged;
+}
+
+// Faults every page of the zone in for writing without changing it: an
+// atomic OR of 0 leaves whatever a live block holds there
+static void prefault_zone(Zone *zone) {
+    size_t page_size = get_os_page_size();
+
+    for (size_t offset = 0; offset < zone->size; offset += page_size) {
+        __atomic_fetch_or(zone->base + offset, 0, __ATOMIC_RELAXED);
+    }
+}
+
+// Makes every page of the zone resident, and keeps it so with lock_pages.
+// The purge marks on its blocks no longer hold afterwards.
+static bool make_zone_resident(Zone *zone, bool lock_pages) {
+    if (lock_pages) {
+        if (mlock(zone->base, zone->size) != 0) return false;
+    } else {
+        prefault_zone(zone);
+    }
+    for (Block *block = zone->blocks; block; block = block->next) block->flags &= ~BLOCK_PURGE_FLAGS;
+    return true;
+}
+
+// Maps a zone of at least size bytes for the class, then makes it and every
+// zone the class already has resident, faulting them in or locking them in
+// memory, since those keep serving allocations too. The class then switches
+// to real-time mode: from then on it serves allocations only from the zones
+// it has, never unmaps or purges them, and its lock never parks, so neither
+// malloc() nor free() on it makes a syscall. Allocations it cannot serve
+// fail with ENOMEM and count as exhausted.
+bool reserve_heap(ZoneType type, size_t size, bool lock_pages) {
+    Heap *heap = get_heap(type);
+    Zone *zone = map_zone_memory(type, size);
+    if (!zone) return false;
+
+    init_zone_block(zone, 0);
+    if (!make_zone_resident(zone, lock_pages)) {
+        int error = errno;
+        unmap_zone(zone);
+        errno = error;
+        return false;
+    }
+
+    // Consolidating writes block headers, so it goes before the prefault
+    lock_heap(heap);
+    consolidate_fast_bins(heap, NULL);
+    bool resident = true;
+    for (Zone *other = heap->zones; other && resident; other = other->next) {
+        resident = make_zone_resident(other, lock_pages);
+    }
+    if (!resident || !link_zone(heap, zone)) {
+        int error = resident ? ENOMEM : errno;
+        unlock_heap(heap);
+        unmap_zone(zone);
+        errno = error;
+        return false;
+    }
+    stat_add(&heap->stats.reserved, zone->size);
+    __atomic_store_n(&heap->realtime, true, __ATOMIC_RELEASE);
+    lock_set_spin_only(&heap->lock);
+    unlock_heap(heap);
+    return true;
+}
+
+static void report_zone(Zone *zone, ClassReport *report) {
+    size_t allocated = 0;
+
+    report->zones++;
+    report->mapped += zone->size;
+    report->overhead += zone->offset;
+
+    for (Block *block = zone->blocks; block; block = block->next) {
+        size_t payload = get_block_size(block);
+
+        if (block->status == ALLOCATED) {
+            report->allocated_blocks++;
+            report->in_use += payload;
+            report->requested += payload - block->slack;
+            report->overhead += sizeof(Block);
+            allocated += block->size;
+        } else {
+            size_t bucket = (payload < 32) ? 0 : (size_t)(63 - __builtin_clzll(payload)) - 4;
+            if (bucket >= REPORT_SIZE_BUCKETS) bucket = REPORT_SIZE_BUCKETS - 1;
+
+            report->free_blocks++;
+            report->free += block->size;
+            report->free_sizes[bucket]++;
+            if (block->size > report->largest_free) report->largest_free = block->size;
+        }
+    }
+
+    size_t tenth = allocated * REPORT_OCCUPANCY_BUCKETS / (zone->size - zone->offset);
+    report->occupancy[(tenth < REPORT_OCCUPANCY_BUCKETS) ? tenth : REPORT_OCCUPANCY_BUCKETS - 1]++;
+}
+
+// One pass over each class under its lock; classes are visited one after
+// the other, as in show_alloc_mem()
+void malloc_heap_report(HeapReport *report) {
+    if (!report) return;
+
+    ft_memset(report, 0, sizeof(HeapReport));
+    for (int type = TINY; type <= LARGE; type++) {
+        Heap *heap = &heaps[type];
+        ClassReport *class_report = &report->classes[type];
+        if (!is_heap_ready(heap)) continue;
+
+        lock_heap(heap);
+        for (Zone *zone = heap->zones; zone; zone = zone->next) report_zone(zone, class_report);
+        unlock_heap(heap);
+
+        size_t spent = class_report->in_use + class_report->overhead;
+        if (spent) {
+            class_report->internal = (spent - class_report->requested) * 1000 / spent;
+        }
+        if (class_report->free) {
+            class_report->external = (class_report->free - class_report->largest_free) * 1000 / class_report->free;
+        }
+    }
+}
+
+// Copies the zone and block headers of one class under its lock; payloads
+// are left for the caller to read once the lock is dropped
+void snapshot_heap(ZoneType type, SnapshotBuffer *buffer) {
+    Heap *heap = &heaps[type];
+    if (!is_heap_ready(heap)) return;
+
+    lock_heap(heap);
+    for (Zone *zone = heap->zones; zone && !buffer->failed; zone = zone->next) {
+        size_t zone_offset = buffer->length;
+        SnapshotZone *zone_record = snapshot_reserve(buffer, sizeof(SnapshotZone));
+        if (!zone_record) break;
+
+        zone_record->address = (uint64_t)(uintptr_t)zone->base;
+        zone_record->size = zone->size;
+        zone_record->type = zone->type;
+
+        uint32_t count = 0;
+        for (Block *block = zone->blocks; block; block = block->next) {
+            SnapshotBlock *record = snapshot_reserve(buffer, sizeof(SnapshotBlock));
+            if (!record) break;
+
+            record->address = (uint64_t)(uintptr_t)get_block_start(block);
+            record->size = get_block_size(block);
+            record->status = (block->status == ALLOCATED) ? SNAPSHOT_ALLOCATED : SNAPSHOT_FREE;
+            record->flags = block->flags;
+            record->slack = block->slack;
+            if (record->status == SNAPSHOT_ALLOCATED) buffer->content_bytes += record->size;
+            count++;
+        }
+
+        // The buffer may have moved while it grew
+        ((SnapshotZone *)(buffer->data + zone_offset))->block_count = count;
+        buffer->zones++;
+        buffer->blocks += count;
+    }
+    unlock_heap(heap);
+}
+
+void malloc_lock_stats(ZoneType type, LockStats *stats) {
+    if (!stats || type > LARGE) return;
+    lock_get_stats(&heaps[type].lock, stats);
+}
+
+static void read_class_stats(Heap *heap, ClassStats *stats) {
+    stats->in_use = __atomic_load_n(&heap->stats.in_use, __ATOMIC_RELAXED);
+    stats->free = __atomic_load_n(&heap->stats.free, __ATOMIC_RELAXED);
+    stats->mapped = __atomic_load_n(&heap->stats.mapped, __ATOMIC_RELAXED);
+    stats->zones = __atomic_load_n(&heap->stats.zones, __ATOMIC_RELAXED);
+    stats->allocations = __atomic_load_n(&heap->stats.allocations, __ATOMIC_RELAXED);
+    stats->frees = __atomic_load_n(&heap->stats.frees, __ATOMIC_RELAXED);
+    stats->reserved = __atomic_load_n(&heap->stats.reserved, __ATOMIC_RELAXED);
+    stats->peak = __atomic_load_n(&heap->stats.peak, __ATOMIC_RELAXED);
+    stats->exhausted = __atomic_load_n(&heap->stats.exhausted, __ATOMIC_RELAXED);
+}
+
+// Blocks handed out from thread caches are only folded into the TINY stats
+// at the next cached free or flush
+static void add_cache_stats(ClassStats *stats) {
+    size_t allocations, bytes;
+
+    cache_pending(&allocations, &bytes);
+    stats->allocations += allocations;
+    stats->in_use += bytes - allocations * sizeof(Block);
+    stats->free = (stats->free > bytes) ? stats->free - bytes : 0;
+}
+
+static size_t get_fragmentation(ClassStats *stats) {
+    size_t usable = stats->in_use + stats->free;
+    return usable ? stats->free * 1000 / usable : 0;
+}
+
+// Reads the incrementally maintained counters without taking any heap lock,
+// so it is cheap enough to poll; classes are sampled one after the other
+// and may be a few operations apart.
+void malloc_get_stats(MallocStats *stats) {
+    if (!stats) return;
+
+    ft_memset(stats, 0, sizeof(MallocStats));
+
+    for (int type = TINY; type <= LARGE; type++) {
+        ClassStats *class_stats = &stats->classes[type];
+
+        read_class_stats(&heaps[type], class_stats);
+        if (type == TINY) add_cache_stats(class_stats);
+        class_stats->fragmentation = get_fragmentation(class_stats);
+        lock_get_stats(&heaps[type].lock, &stats->locks[type]);
+
+        stats->total.in_use += class_stats->in_use;
+        stats->total.free += class_stats->free;
+        stats->total.mapped += class_stats->mapped;
+        stats->total.zones += class_stats->zones;
+        stats->total.allocations += class_stats->allocations;
+        stats->total.frees += class_stats->frees;
+        stats->total.reserved += class_stats->reserved;
+        stats->total.peak += class_stats->peak;
+        stats->total.exhausted += class_stats->exhausted;
+    }
+    stats->total.fragmentation = get_fragmentation(&stats->total);
+}
+
+static void show_class_stats(const char *name, ClassStats *stats) {
+    ft_printf("%s : in use %z, free %z, mapped %z bytes, %z zones, "
+              "%z allocs, %z frees, fragmentation %z.%z%%\n",
+              name, stats->in_use, stats->free, stats->mapped, stats->zones,
+              stats->allocations, stats->frees,
+              stats->fragmentation / 10, stats->fragmentation % 10);
+    if (stats->reserved) {
+        ft_printf("%s : reserved %z, peak in use %z, %z allocs refused\n",
+                  name, stats->reserved, stats->peak, stats->exhausted);
+    }
+}
+
+void malloc_stats(void) {
+    MallocStats stats;
+
+    malloc_get_stats(&stats);
+    for (int type = TINY; type <= LARGE; type++) {
+        show_class_stats(get_zone_type_str(type), &stats.classes[type]);
+    }
+    show_class_stats("Total", &stats.total);
 }
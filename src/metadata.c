@@ -0,0 +1,46 @@
+#include "malloc.h"
+#include "internal.h"
+
+#include <sys/mman.h>
+
+// Zone descriptors are carved from chunks mapped for nothing else, densely
+// packed, and freed ones are handed out again before the chunk is bumped.
+// Chunks are never unmapped: there are only as many descriptors as zones.
+#define METADATA_CHUNK_SIZE (64 * 1024)
+
+static Lock metadata_lock = LOCK_INITIALIZER;
+static Zone *free_descriptors = NULL;
+static char *chunk_cursor = NULL;
+static char *chunk_end = NULL;
+
+// Chunks come from mmap so descriptors never call back into malloc
+Zone *zone_descriptor_alloc(void) {
+    Zone *zone = NULL;
+
+    lock_acquire(&metadata_lock);
+    if (free_descriptors) {
+        zone = free_descriptors;
+        free_descriptors = zone->next;
+    } else {
+        if (chunk_cursor == chunk_end) {
+            void *chunk = mmap(NULL, METADATA_CHUNK_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (chunk != MAP_FAILED) {
+                chunk_cursor = chunk;
+                chunk_end = chunk_cursor + METADATA_CHUNK_SIZE;
+            }
+        }
+        if (chunk_cursor != chunk_end) {
+            zone = (Zone *)chunk_cursor;
+            chunk_cursor += sizeof(Zone);
+        }
+    }
+    lock_release(&metadata_lock);
+    return zone;
+}
+
+void zone_descriptor_free(Zone *zone) {
+    lock_acquire(&metadata_lock);
+    zone->next = free_descriptors;
+    free_descriptors = zone;
+    lock_release(&metadata_lock);
+}
@@ -0,0 +1,51 @@
+#include "malloc.h"
+#include "internal.h"
+#include "pagemap.h"
+
+#include <sys/mman.h>
+
+PageMapNode *pagemap_root[1 << PAGEMAP_ROOT_BITS];
+
+// Nodes come from mmap so the map never calls back into malloc. Two threads
+// may race to install the same node; the loser unmaps its copy.
+static void *get_child(void **slot, size_t size) {
+    void *child = __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+    if (child) return child;
+
+    void *memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) return NULL;
+
+    if (!__atomic_compare_exchange_n(slot, &child, memory, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        munmap(memory, size);
+        return child;
+    }
+    return memory;
+}
+
+// Points every page of [start, start + size) at entry. Fails when a node
+// cannot be mapped or the range is beyond the map, possibly after setting
+// some of the pages; clearing the range again undoes that.
+bool pagemap_set(const void *start, size_t size, uintptr_t entry) {
+    uintptr_t first = (uintptr_t)start >> PAGEMAP_PAGE_SHIFT;
+    uintptr_t last = ((uintptr_t)start + size - 1) >> PAGEMAP_PAGE_SHIFT;
+
+    if (last >> (PAGEMAP_ROOT_BITS + PAGEMAP_NODE_BITS + PAGEMAP_LEAF_BITS)) return false;
+
+    for (uintptr_t page = first; page <= last;) {
+        PageMapNode *node = get_child((void **)&pagemap_root[page >> (PAGEMAP_NODE_BITS + PAGEMAP_LEAF_BITS)],
+                                      sizeof(PageMapNode));
+        if (!node) return false;
+
+        PageMapLeaf *leaf = get_child((void **)&node->leaves[(page >> PAGEMAP_LEAF_BITS) & ((1 << PAGEMAP_NODE_BITS) - 1)],
+                                      sizeof(PageMapLeaf));
+        if (!leaf) return false;
+
+        // Fill up to the end of this leaf or of the range
+        uintptr_t leaf_end = (page | ((1 << PAGEMAP_LEAF_BITS) - 1));
+        uintptr_t end = (leaf_end < last) ? leaf_end : last;
+        for (; page <= end; page++) {
+            __atomic_store_n(&leaf->entries[page & ((1 << PAGEMAP_LEAF_BITS) - 1)], entry, __ATOMIC_RELAXED);
+        }
+    }
+    return true;
+}
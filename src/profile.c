@@ -0,0 +1,417 @@
+#include "malloc.h"
+#include "internal.h"
+#include "libft.h"
+#include "profile.h"
+#include "writer.h"
+
+#include <errno.h>
+#include <execinfo.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <link.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+typedef struct ProfStack {
+    uint64_t hash;
+    size_t depth;
+    void *pcs[PROF_MAX_DEPTH];
+    size_t live_count;
+    size_t live_bytes;
+    size_t alloc_count;
+    size_t alloc_bytes;
+} ProfStack;
+
+typedef struct ProfSample {
+    void *ptr;
+    size_t size;
+    ProfStack *stack;
+} ProfSample;
+
+// Dumps can be written from inside malloc() on an application thread with
+// little stack left, so their buffers are mapped for the dump instead
+typedef struct ProfScratch {
+    char output[65536];
+    char maps[4096];
+    char path[PATH_MAX];
+} ProfScratch;
+
+typedef struct ProfThread {
+    int64_t until_sample;
+    uint64_t seed;
+    bool busy;
+    bool ready;
+} ProfThread;
+
+size_t prof_rate = 0;
+
+static Lock prof_lock = LOCK_INITIALIZER;
+static ProfStack *stacks = NULL;
+static ProfSample *samples = NULL;
+static size_t sample_count = 0;
+
+static const char *dump_prefix = NULL;
+static int dump_pending = 0;
+static size_t dump_sequence = 0;
+
+static __thread ProfThread prof_thread __attribute__((tls_model("initial-exec")));
+
+// The linker places this library's ELF header at __ehdr_start. Hidden so that
+// it resolves to this object rather than to the executable's own copy.
+extern const char __ehdr_start[] __attribute__((visibility("hidden")));
+static const char *text_start = NULL;
+static const char *text_end = NULL;
+
+static uint64_t next_random(ProfThread *thread) {
+    thread->seed ^= thread->seed >> 12;
+    thread->seed ^= thread->seed << 25;
+    thread->seed ^= thread->seed >> 27;
+    return thread->seed * 0x2545F4914F6CDD1DULL;
+}
+
+// Natural log without libm: split x into mantissa and exponent, then use the
+// atanh series on the mantissa, which is accurate to ~1e-7 over [1, 2)
+static double fast_log(double x) {
+    union { double d; uint64_t u; } bits = {x};
+    int exponent = (int)((bits.u >> 52) & 0x7FF) - 1023;
+
+    bits.u = (bits.u & 0x000FFFFFFFFFFFFFULL) | 0x3FF0000000000000ULL;
+    double t = (bits.d - 1.0) / (bits.d + 1.0);
+    double t2 = t * t;
+    double series = t * (2.0 + t2 * (2.0 / 3 + t2 * (2.0 / 5 + t2 * (2.0 / 7 + t2 * (2.0 / 9)))));
+
+    return exponent * 0.6931471805599453 + series;
+}
+
+// Sampling points form a Poisson process over allocated bytes, which is what
+// pprof assumes when it scales heap_v2 samples back up
+static int64_t pick_interval(ProfThread *thread, size_t rate) {
+    double uniform = (double)((next_random(thread) >> 11) + 1) * (1.0 / 9007199254740992.0);
+    return (int64_t)(-fast_log(uniform) * (double)rate) + 1;
+}
+
+bool prof_should_sample(size_t size) {
+    ProfThread *thread = &prof_thread;
+    size_t rate = __atomic_load_n(&prof_rate, __ATOMIC_RELAXED);
+
+    if (!rate || thread->busy) return false;
+
+    // Thread state is set up on the thread's first allocation
+    if (!thread->ready) {
+        thread->seed = (uint64_t)(uintptr_t)thread * 0x9E3779B97F4A7C15ULL | 1;
+        thread->until_sample = pick_interval(thread, rate);
+        thread->ready = true;
+    }
+
+    thread->until_sample -= (int64_t)size;
+    if (thread->until_sample > 0) return false;
+
+    thread->until_sample = pick_interval(thread, rate);
+    return true;
+}
+
+static void *map_table(size_t size) {
+    void *memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return (memory == MAP_FAILED) ? NULL : memory;
+}
+
+static bool ensure_tables(void) {
+    if (!stacks) stacks = map_table(PROF_STACK_SLOTS * sizeof(ProfStack));
+    if (!samples) samples = map_table(PROF_SAMPLE_SLOTS * sizeof(ProfSample));
+    return stacks && samples;
+}
+
+static inline size_t hash_ptr(void *ptr) {
+    return (size_t)(((uintptr_t)ptr >> 4) * 0x9E3779B97F4A7C15ULL >> 32);
+}
+
+static uint64_t hash_stack(void **pcs, size_t depth) {
+    uint64_t hash = 0xCBF29CE484222325ULL;
+
+    for (size_t i = 0; i < depth; i++) {
+        hash ^= (uint64_t)(uintptr_t)pcs[i];
+        hash *= 0x100000001B3ULL;
+    }
+    return hash ? hash : 1;
+}
+
+static ProfStack *find_stack(void **pcs, size_t depth) {
+    uint64_t hash = hash_stack(pcs, depth);
+    size_t mask = PROF_STACK_SLOTS - 1;
+
+    for (size_t probe = 0; probe < PROF_STACK_SLOTS; probe++) {
+        ProfStack *stack = &stacks[(hash + probe) & mask];
+
+        if (!stack->hash) {
+            stack->hash = hash;
+            stack->depth = depth;
+            for (size_t i = 0; i < depth; i++) stack->pcs[i] = pcs[i];
+            return stack;
+        }
+        if (stack->hash == hash && stack->depth == depth) {
+            size_t i = 0;
+            while (i < depth && stack->pcs[i] == pcs[i]) i++;
+            if (i == depth) return stack;
+        }
+    }
+    return NULL;
+}
+
+static ProfSample *find_sample(void *ptr) {
+    size_t mask = PROF_SAMPLE_SLOTS - 1;
+
+    for (size_t i = hash_ptr(ptr) & mask; samples[i].ptr; i = (i + 1) & mask) {
+        if (samples[i].ptr == ptr) return &samples[i];
+    }
+    return NULL;
+}
+
+// Linear probing with backward-shift deletion, so no tombstones build up
+static void remove_sample(ProfSample *sample) {
+    size_t mask = PROF_SAMPLE_SLOTS - 1;
+    size_t hole = (size_t)(sample - samples);
+
+    for (size_t i = (hole + 1) & mask; samples[i].ptr; i = (i + 1) & mask) {
+        size_t home = hash_ptr(samples[i].ptr) & mask;
+        bool movable = (hole <= i) ? (home <= hole || home > i) : (home <= hole && home > i);
+
+        if (movable) {
+            samples[hole] = samples[i];
+            hole = i;
+        }
+    }
+    samples[hole].ptr = NULL;
+    sample_count--;
+}
+
+static void write_profile(Writer *writer) {
+    size_t live_count = 0, live_bytes = 0, alloc_count = 0, alloc_bytes = 0;
+
+    for (size_t i = 0; i < PROF_STACK_SLOTS; i++) {
+        live_count += stacks[i].live_count;
+        live_bytes += stacks[i].live_bytes;
+        alloc_count += stacks[i].alloc_count;
+        alloc_bytes += stacks[i].alloc_bytes;
+    }
+
+    write_str(writer, "heap profile: ");
+    write_u64(writer, live_count);
+    write_str(writer, ": ");
+    write_u64(writer, live_bytes);
+    write_str(writer, " [");
+    write_u64(writer, alloc_count);
+    write_str(writer, ": ");
+    write_u64(writer, alloc_bytes);
+    write_str(writer, "] @ heap_v2/");
+    write_u64(writer, __atomic_load_n(&prof_rate, __ATOMIC_RELAXED));
+    write_char(writer, '\n');
+
+    for (size_t i = 0; i < PROF_STACK_SLOTS; i++) {
+        ProfStack *stack = &stacks[i];
+        if (!stack->hash || !stack->alloc_count) continue;
+
+        write_u64(writer, stack->live_count);
+        write_str(writer, ": ");
+        write_u64(writer, stack->live_bytes);
+        write_str(writer, " [");
+        write_u64(writer, stack->alloc_count);
+        write_str(writer, ": ");
+        write_u64(writer, stack->alloc_bytes);
+        write_str(writer, "] @");
+        for (size_t j = 0; j < stack->depth; j++) {
+            write_char(writer, ' ');
+            write_hex(writer, (uint64_t)(uintptr_t)stack->pcs[j]);
+        }
+        write_char(writer, '\n');
+    }
+}
+
+static void write_mapped_libraries(Writer *writer, char *buffer, size_t size) {
+    int fd = open("/proc/self/maps", O_RDONLY);
+    if (fd < 0) return;
+
+    write_str(writer, "\nMAPPED_LIBRARIES:\n");
+    ssize_t count;
+    while ((count = read(fd, buffer, size)) > 0) {
+        write_bytes(writer, buffer, (size_t)count);
+    }
+    close(fd);
+}
+
+static int write_dump(int fd, ProfScratch *scratch) {
+    Writer writer;
+
+    writer_init(&writer, fd, scratch->output, sizeof(scratch->output));
+
+    lock_acquire(&prof_lock);
+    if (!ensure_tables()) {
+        lock_release(&prof_lock);
+        errno = ENOMEM;
+        return -1;
+    }
+    write_profile(&writer);
+    lock_release(&prof_lock);
+
+    write_mapped_libraries(&writer, scratch->maps, sizeof(scratch->maps));
+    return writer_flush(&writer) ? 0 : -1;
+}
+
+// Writes live sampled allocations, aggregated by stack, in the gperftools
+// heap profile text format that pprof reads
+int malloc_prof_dump(int fd) {
+    ProfScratch *scratch = map_table(sizeof(ProfScratch));
+    if (!scratch) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    int result = write_dump(fd, scratch);
+    munmap(scratch, sizeof(ProfScratch));
+    return result;
+}
+
+static void dump_to_file(void) {
+    size_t length = 0;
+    size_t prefix_length = 0;
+
+    while (dump_prefix[prefix_length]) prefix_length++;
+    if (prefix_length + 64 > PATH_MAX) return;
+
+    ProfScratch *scratch = map_table(sizeof(ProfScratch));
+    if (!scratch) return;
+
+    char *path = scratch->path;
+    ft_memcpy(path, dump_prefix, prefix_length);
+    length = prefix_length;
+    path[length++] = '.';
+    length += format_u64(path + length, (uint64_t)getpid());
+    path[length++] = '.';
+    length += format_u64(path + length, __atomic_fetch_add(&dump_sequence, 1, __ATOMIC_RELAXED));
+    ft_memcpy(path + length, ".heap", 6);
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd >= 0) {
+        write_dump(fd, scratch);
+        close(fd);
+    }
+    munmap(scratch, sizeof(ProfScratch));
+}
+
+static void request_dump(int signum) {
+    (void)signum;
+    __atomic_store_n(&dump_pending, 1, __ATOMIC_RELAXED);
+}
+
+// Records the sampled allocation with its call stack. The thread is marked
+// busy first, since backtrace() may allocate the first time it runs.
+void prof_track(void *ptr, size_t size) {
+    ProfThread *thread = &prof_thread;
+    void *pcs[PROF_MAX_DEPTH + PROF_SKIP_MAX];
+
+    thread->busy = true;
+    int depth = backtrace(pcs, PROF_MAX_DEPTH + PROF_SKIP_MAX);
+
+    // Skip the allocator's own frames, however many entry points were
+    // nested, so a stack starts at the caller of malloc()
+    size_t skip = 0;
+    while (skip < (size_t)depth && (const char *)pcs[skip] >= text_start &&
+           (const char *)pcs[skip] < text_end) {
+        skip++;
+    }
+    void **frames = pcs + skip;
+    size_t frame_count = (size_t)depth - skip;
+    if (frame_count > PROF_MAX_DEPTH) frame_count = PROF_MAX_DEPTH;
+
+    lock_acquire(&prof_lock);
+    ProfStack *stack = ensure_tables() ? find_stack(frames, frame_count) : NULL;
+
+    if (stack && sample_count < PROF_SAMPLE_SLOTS / 4 * 3) {
+        size_t mask = PROF_SAMPLE_SLOTS - 1;
+        size_t i = hash_ptr(ptr) & mask;
+
+        while (samples[i].ptr) i = (i + 1) & mask;
+        samples[i].ptr = ptr;
+        samples[i].size = size;
+        samples[i].stack = stack;
+        sample_count++;
+
+        stack->live_count++;
+        stack->live_bytes += size;
+        stack->alloc_count++;
+        stack->alloc_bytes += size;
+    }
+    lock_release(&prof_lock);
+
+    // A dump requested by signal is written here, outside of any heap lock,
+    // so it only happens at the next sampled allocation of any thread
+    if (dump_prefix && __atomic_exchange_n(&dump_pending, 0, __ATOMIC_RELAXED)) {
+        dump_to_file();
+    }
+    thread->busy = false;
+}
+
+void prof_untrack(void *ptr) {
+    lock_acquire(&prof_lock);
+    ProfSample *sample = samples ? find_sample(ptr) : NULL;
+
+    if (sample) {
+        sample->stack->live_count--;
+        sample->stack->live_bytes -= sample->size;
+        remove_sample(sample);
+    }
+    lock_release(&prof_lock);
+}
+
+// Finds this library's executable segment from its own program headers, so
+// that no linker symbol has to be exported and no loader lock is taken
+static void find_text(void) {
+    const ElfW(Ehdr) *header = (const ElfW(Ehdr) *)__ehdr_start;
+    const ElfW(Phdr) *segments = (const ElfW(Phdr) *)(__ehdr_start + header->e_phoff);
+    uintptr_t bias = 0;
+
+    for (size_t i = 0; i < header->e_phnum; i++) {
+        if (segments[i].p_type == PT_LOAD && segments[i].p_offset == 0) {
+            bias = (uintptr_t)__ehdr_start - segments[i].p_vaddr;
+        }
+    }
+    for (size_t i = 0; i < header->e_phnum; i++) {
+        if (segments[i].p_type != PT_LOAD || !(segments[i].p_flags & PF_X)) continue;
+        text_start = (const char *)(bias + segments[i].p_vaddr);
+        text_end = text_start + segments[i].p_memsz;
+    }
+}
+
+void malloc_prof_set_rate(size_t rate) {
+    __atomic_store_n(&prof_rate, rate, __ATOMIC_RELAXED);
+}
+
+// FT_MALLOC_PROF_RATE enables sampling at start-up. FT_MALLOC_PROF_FILE names
+// the prefix of dumps written at exit and, with FT_MALLOC_PROF_SIGNAL, after
+// that signal. The handler only flags the request: the dump is written at
+// the next sampled allocation, so a process that stops allocating writes it
+// at exit.
+void prof_init(void) {
+    const char *rate = getenv("FT_MALLOC_PROF_RATE");
+    const char *signum = getenv("FT_MALLOC_PROF_SIGNAL");
+
+    find_text();
+    dump_prefix = getenv("FT_MALLOC_PROF_FILE");
+
+    if (signum && dump_prefix) {
+        struct sigaction action;
+
+        ft_memset(&action, 0, sizeof(action));
+        action.sa_handler = request_dump;
+        action.sa_flags = SA_RESTART;
+        sigemptyset(&action.sa_mask);
+        sigaction(ft_atoi(signum), &action, NULL);
+    }
+    if (rate && ft_atoi(rate) > 0) malloc_prof_set_rate((size_t)ft_atoi(rate));
+}
+
+__attribute__((destructor))
+static void prof_exit(void) {
+    if (prof_enabled() && dump_prefix) dump_to_file();
+}
@@ -0,0 +1,72 @@
+#include "malloc.h"
+#include "internal.h"
+#include "libft.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <time.h>
+
+static size_t purge_window = 0;
+static int purger_started = 0;
+
+// Releases the spare empty zones, including those kept from destroyed
+// arenas, and returns the pages of free blocks to the kernel, leaving pad
+// bytes of free memory resident. The caller's
+// cached blocks are flushed first so they can be purged too. Returns 1 if
+// any memory was released, like glibc.
+int malloc_trim(size_t pad) {
+    malloc_thread_flush();
+    size_t released = purge_heaps(pad, false);
+    released += arena_trim();
+    return released > 0;
+}
+
+// Each pass marks what is free and purges what was already free at the
+// previous one, so with passes half a window apart memory that stays free
+// for a whole window is always returned. A window of 0 pauses purging, and
+// passes are at least a millisecond apart, so a 1 ms window cannot spin.
+static void *purger(void *arg) {
+    (void)arg;
+
+    for (;;) {
+        size_t window = __atomic_load_n(&purge_window, __ATOMIC_RELAXED);
+        size_t period = window ? window / 2 : 1000;
+        if (!period) period = 1;
+        struct timespec delay = {(time_t)(period / 1000), (long)(period % 1000) * 1000000L};
+
+        nanosleep(&delay, NULL);
+        if (window) purge_heaps(0, true);
+    }
+    return NULL;
+}
+
+// Purging runs on its own thread, so free() never waits on madvise
+void malloc_set_purge_window(size_t milliseconds) {
+    int expected = 0;
+
+    __atomic_store_n(&purge_window, milliseconds, __ATOMIC_RELAXED);
+    if (!milliseconds || !__atomic_compare_exchange_n(&purger_started, &expected, 1, false,
+                                                      __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+        return;
+    }
+
+    pthread_attr_t attributes;
+    pthread_t thread;
+
+    pthread_attr_init(&attributes);
+    pthread_attr_setdetachstate(&attributes, PTHREAD_CREATE_DETACHED);
+    if (pthread_create(&thread, &attributes, purger, NULL) != 0) {
+        __atomic_store_n(&purger_started, 0, __ATOMIC_RELEASE);
+    }
+    pthread_attr_destroy(&attributes);
+}
+
+// FT_MALLOC_PURGE_MS=<window> starts the purger. It is read from a
+// constructor rather than on the first allocation, so the thread is never
+// created from inside malloc().
+__attribute__((constructor))
+static void purge_init(void) {
+    const char *window = getenv("FT_MALLOC_PURGE_MS");
+
+    if (window && ft_atoi(window) > 0) malloc_set_purge_window((size_t)ft_atoi(window));
+}
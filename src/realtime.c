@@ -0,0 +1,69 @@
+#include "malloc.h"
+#include "internal.h"
+#include "cache.h"
+
+#include <stdlib.h>
+
+// Reserves tiny, small and large bytes up front for the three classes. A
+// class given a reserve switches to real-time mode, see reserve_heap(), and
+// the zones it already has are faulted in or locked along with the reserve;
+// a class given 0 is left as it is. Call it at startup, before the real-time
+// threads allocate: once TINY is reserved, threads without a cache do not
+// get one, since creating it maps memory. The sampling profiler and the
+// trace recorder make syscalls of their own and stay outside the
+// guarantee. Returns 0, or -1 with errno set when a reserve could not be
+// mapped or locked; the classes reserved before it keep theirs.
+int malloc_reserve(size_t tiny, size_t small, size_t large, int flags) {
+    size_t sizes[3] = {tiny, small, large};
+
+    for (int type = TINY; type <= LARGE; type++) {
+        if (!sizes[type]) continue;
+        if (!reserve_heap(type, sizes[type], flags & MALLOC_RESERVE_LOCK)) return -1;
+        if (type == TINY) cache_disable();
+    }
+    return 0;
+}
+
+// A byte count with an optional K, M or G suffix. Returns false when it
+// does not fit in a size_t.
+static bool parse_size(const char **cursor, size_t *size) {
+    const char *digit = *cursor;
+    size_t value = 0;
+    unsigned shift = 0;
+
+    while (*digit >= '0' && *digit <= '9') {
+        size_t d = (size_t)(*digit++ - '0');
+        if (value > (SIZE_MAX - d) / 10) return false;
+        value = value * 10 + d;
+    }
+    switch (*digit) {
+        case 'k': case 'K': shift = 10; digit++; break;
+        case 'm': case 'M': shift = 20; digit++; break;
+        case 'g': case 'G': shift = 30; digit++; break;
+        default: break;
+    }
+    if (value > SIZE_MAX >> shift) return false;
+    *cursor = digit;
+    *size = value << shift;
+    return true;
+}
+
+// FT_MALLOC_RESERVE=<tiny>,<small>,<large> reserves at startup, and
+// FT_MALLOC_RESERVE_LOCK=1 locks the reserves in memory. A value with a size
+// that overflows is ignored as a whole.
+__attribute__((constructor))
+static void reserve_init(void) {
+    const char *value = getenv("FT_MALLOC_RESERVE");
+    size_t sizes[3] = {0, 0, 0};
+    if (!value) return;
+
+    for (int type = TINY; type <= LARGE && *value; type++) {
+        if (!parse_size(&value, &sizes[type])) return;
+        if (*value != ',') break;
+        value++;
+    }
+
+    const char *lock = getenv("FT_MALLOC_RESERVE_LOCK");
+    malloc_reserve(sizes[TINY], sizes[SMALL], sizes[LARGE],
+                   (lock && lock[0] == '1' && !lock[1]) ? MALLOC_RESERVE_LOCK : 0);
+}
@@ -0,0 +1,98 @@
+#include "malloc.h"
+#include "internal.h"
+#include "libft.h"
+#include "writer.h"
+
+static const char *class_names[3] = {"TINY", "SMALL", "LARGE"};
+
+static void show_class_report(const char *name, ClassReport *report) {
+    ft_printf("%s : %z zones, %z bytes mapped\n", name, report->zones, report->mapped);
+    ft_printf("  allocated : %z blocks, %z bytes requested, %z in use, %z overhead\n",
+              report->allocated_blocks, report->requested, report->in_use, report->overhead);
+    ft_printf("  free      : %z blocks, %z bytes, largest %z\n",
+              report->free_blocks, report->free, report->largest_free);
+    ft_printf("  fragmentation : internal %z.%z%%, external %z.%z%%\n",
+              report->internal / 10, report->internal % 10,
+              report->external / 10, report->external % 10);
+
+    ft_printf("  free sizes :");
+    for (int i = 0; i < REPORT_SIZE_BUCKETS; i++) {
+        if (report->free_sizes[i]) ft_printf(" %z+:%z", (size_t)16 << i, report->free_sizes[i]);
+    }
+    ft_printf("\n  occupancy  :");
+    for (int i = 0; i < REPORT_OCCUPANCY_BUCKETS; i++) {
+        ft_printf(" %z%%:%z", (size_t)i * 10, report->occupancy[i]);
+    }
+    ft_printf("\n");
+}
+
+// Summary counterpart of show_alloc_mem(): a few lines per class instead of
+// one per block
+void show_alloc_report(void) {
+    HeapReport report;
+
+    malloc_heap_report(&report);
+    for (int type = TINY; type <= LARGE; type++) {
+        show_class_report(class_names[type], &report.classes[type]);
+    }
+}
+
+static void write_field(Writer *writer, const char *name, size_t value, bool last) {
+    write_char(writer, '"');
+    write_str(writer, name);
+    write_str(writer, "\": ");
+    write_u64(writer, value);
+    if (!last) write_str(writer, ", ");
+}
+
+static void write_array(Writer *writer, const char *name, size_t *values, int count) {
+    write_char(writer, '"');
+    write_str(writer, name);
+    write_str(writer, "\": [");
+    for (int i = 0; i < count; i++) {
+        if (i) write_str(writer, ", ");
+        write_u64(writer, values[i]);
+    }
+    write_char(writer, ']');
+}
+
+static void write_class_report(Writer *writer, const char *name, ClassReport *report) {
+    write_str(writer, "  \"");
+    write_str(writer, name);
+    write_str(writer, "\": {");
+    write_field(writer, "zones", report->zones, false);
+    write_field(writer, "mapped", report->mapped, false);
+    write_field(writer, "allocated_blocks", report->allocated_blocks, false);
+    write_field(writer, "free_blocks", report->free_blocks, false);
+    write_field(writer, "requested", report->requested, false);
+    write_field(writer, "in_use", report->in_use, false);
+    write_field(writer, "overhead", report->overhead, false);
+    write_field(writer, "free", report->free, false);
+    write_field(writer, "largest_free", report->largest_free, false);
+    write_field(writer, "internal_permille", report->internal, false);
+    write_field(writer, "external_permille", report->external, false);
+    write_array(writer, "free_sizes", report->free_sizes, REPORT_SIZE_BUCKETS);
+    write_str(writer, ", ");
+    write_array(writer, "occupancy", report->occupancy, REPORT_OCCUPANCY_BUCKETS);
+    write_char(writer, '}');
+}
+
+// Same report as JSON. free_sizes[i] counts free blocks with a payload of
+// at least 16 << i bytes (the first bucket also holds anything smaller);
+// occupancy[i] counts zones that are i to i + 1 tenths allocated.
+int malloc_heap_report_json(int fd) {
+    char buffer[4096];
+    HeapReport report;
+    Writer writer;
+
+    malloc_heap_report(&report);
+    writer_init(&writer, fd, buffer, sizeof(buffer));
+
+    write_str(&writer, "{\n");
+    for (int type = TINY; type <= LARGE; type++) {
+        write_class_report(&writer, class_names[type], &report.classes[type]);
+        write_str(&writer, (type < LARGE) ? ",\n" : "\n");
+    }
+    write_str(&writer, "}\n");
+    return writer_flush(&writer) ? 0 : -1;
+}
@@ -0,0 +1,131 @@
+#define _GNU_SOURCE
+#include "malloc.h"
+#include "internal.h"
+#include "libft.h"
+#include "snapshot.h"
+#include "writer.h"
+
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+// Payloads are staged through this much memory at a time
+#define SNAPSHOT_STAGING_SIZE (1024 * 1024)
+#define SNAPSHOT_IOV_MAX 1024
+
+void *snapshot_reserve(SnapshotBuffer *buffer, size_t size) {
+    if (buffer->failed) return NULL;
+
+    if (buffer->length + size > buffer->capacity) {
+        size_t capacity = buffer->capacity ? buffer->capacity * 2 : SNAPSHOT_STAGING_SIZE;
+        void *data = buffer->data
+            ? mremap(buffer->data, buffer->capacity, capacity, MREMAP_MAYMOVE)
+            : mmap(NULL, capacity, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+        if (data == MAP_FAILED) {
+            buffer->failed = true;
+            return NULL;
+        }
+        buffer->data = data;
+        buffer->capacity = capacity;
+    }
+
+    void *result = buffer->data + buffer->length;
+    buffer->length += size;
+    return result;
+}
+
+// Reads the pieces with process_vm_readv, which reports EFAULT instead of
+// faulting when a block was freed and its zone unmapped after the metadata
+// copy; such pieces are written as zeros
+static void read_pieces(struct iovec *local, struct iovec *remote, size_t count) {
+    pid_t pid = getpid();
+
+    if (process_vm_readv(pid, local, count, remote, count, 0) >= 0) return;
+    for (size_t i = 0; i < count; i++) {
+        if (process_vm_readv(pid, &local[i], 1, &remote[i], 1, 0) != (ssize_t)local[i].iov_len) {
+            ft_memset(local[i].iov_base, 0, local[i].iov_len);
+        }
+    }
+}
+
+static void write_contents(Writer *writer, SnapshotBuffer *buffer, char *staging) {
+    struct iovec local[SNAPSHOT_IOV_MAX];
+    struct iovec remote[SNAPSHOT_IOV_MAX];
+    size_t pieces = 0, staged = 0;
+
+    for (size_t offset = 0; offset < buffer->length;) {
+        SnapshotZone *zone = (SnapshotZone *)(buffer->data + offset);
+        SnapshotBlock *blocks = (SnapshotBlock *)(zone + 1);
+        offset += sizeof(SnapshotZone) + zone->block_count * sizeof(SnapshotBlock);
+
+        for (uint32_t i = 0; i < zone->block_count; i++) {
+            if (blocks[i].status != SNAPSHOT_ALLOCATED) continue;
+
+            for (size_t done = 0; done < blocks[i].size;) {
+                size_t size = blocks[i].size - done;
+                if (size > SNAPSHOT_STAGING_SIZE - staged) size = SNAPSHOT_STAGING_SIZE - staged;
+
+                local[pieces] = (struct iovec){staging + staged, size};
+                remote[pieces] = (struct iovec){(void *)(uintptr_t)(blocks[i].address + done), size};
+                pieces++;
+                staged += size;
+                done += size;
+
+                if (staged == SNAPSHOT_STAGING_SIZE || pieces == SNAPSHOT_IOV_MAX) {
+                    read_pieces(local, remote, pieces);
+                    write_bytes(writer, staging, staged);
+                    pieces = staged = 0;
+                }
+            }
+        }
+    }
+    if (pieces) {
+        read_pieces(local, remote, pieces);
+        write_bytes(writer, staging, staged);
+    }
+}
+
+// Each class is paused only while its headers are copied; the file is
+// written afterwards with large writes. With SNAPSHOT_CONTENTS, payloads
+// are read after the locks are dropped and may be torn by concurrent writes.
+int malloc_snapshot(int fd, int flags) {
+    SnapshotBuffer buffer;
+    char buffer_space[4096];
+    Writer writer;
+
+    ft_memset(&buffer, 0, sizeof(buffer));
+    for (int type = TINY; type <= LARGE; type++) snapshot_heap(type, &buffer);
+
+    char *staging = NULL;
+    if (!buffer.failed && (flags & SNAPSHOT_CONTENTS)) {
+        staging = mmap(NULL, SNAPSHOT_STAGING_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (staging == MAP_FAILED) buffer.failed = true;
+    }
+    if (buffer.failed) {
+        if (buffer.data) munmap(buffer.data, buffer.capacity);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    SnapshotHeader header;
+    ft_memset(&header, 0, sizeof(header));
+    ft_memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+    header.version = SNAPSHOT_VERSION;
+    header.flags = (uint32_t)flags & SNAPSHOT_CONTENTS;
+    header.zone_count = buffer.zones;
+    header.block_count = buffer.blocks;
+    header.content_bytes = staging ? buffer.content_bytes : 0;
+
+    writer_init(&writer, fd, buffer_space, sizeof(buffer_space));
+    write_bytes(&writer, &header, sizeof(header));
+    write_bytes(&writer, buffer.data, buffer.length);
+    if (staging) {
+        write_contents(&writer, &buffer, staging);
+        munmap(staging, SNAPSHOT_STAGING_SIZE);
+    }
+
+    if (buffer.data) munmap(buffer.data, buffer.capacity);
+    return writer_flush(&writer) ? 0 : -1;
+}
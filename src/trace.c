@@ -0,0 +1,187 @@
+#include "malloc.h"
+#include "internal.h"
+#include "latency.h"
+#include "libft.h"
+#include "trace.h"
+#include "writer.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// The chunk header sits right before the encoded bytes so a flush is a
+// single write. The lock is only ever contended at exit, when another
+// thread flushes the buffer on the owner's behalf.
+typedef struct TraceThread {
+    struct TraceThread *next;
+    Lock lock;
+    uint64_t last_timestamp;
+    uint64_t last_ptr;
+    TraceChunk chunk;
+    uint8_t data[TRACE_BUFFER_SIZE];
+} TraceThread;
+
+bool trace_active = false;
+
+static int trace_fd = -1;
+static uint64_t trace_start = 0;
+static uint32_t thread_count = 0;
+static pthread_key_t thread_key;
+
+static Lock threads_lock = LOCK_INITIALIZER;
+static TraceThread *threads = NULL;
+
+static __thread TraceThread *trace_thread __attribute__((tls_model("initial-exec")));
+static __thread bool trace_closed __attribute__((tls_model("initial-exec"))) = false;
+
+// O_APPEND keeps each buffer contiguous in the file even when threads flush
+// at the same time
+static void flush_thread(TraceThread *thread) {
+    if (!thread->chunk.count) return;
+
+    size_t size = sizeof(TraceChunk) + thread->chunk.bytes;
+    char *data = (char *)&thread->chunk;
+
+    while (size) {
+        ssize_t written = write(trace_fd, data, size);
+        if (written <= 0) break;
+        data += written;
+        size -= (size_t)written;
+    }
+    thread->chunk.count = 0;
+    thread->chunk.bytes = 0;
+}
+
+// Runs as the thread exits. Anything it allocates or frees from a later
+// destructor is not recorded, as a new buffer would leak with the thread.
+static void exit_thread(void *arg) {
+    TraceThread *thread = arg;
+
+    trace_closed = true;
+    lock_acquire(&threads_lock);
+    flush_thread(thread);
+    for (TraceThread **link = &threads; *link; link = &(*link)->next) {
+        if (*link == thread) {
+            *link = thread->next;
+            break;
+        }
+    }
+    lock_release(&threads_lock);
+
+    trace_thread = NULL;
+    munmap(thread, sizeof(TraceThread));
+}
+
+// Buffers come from mmap so the recorder never calls back into malloc
+static TraceThread *get_thread(void) {
+    if (trace_thread || trace_closed) return trace_thread;
+
+    void *memory = mmap(NULL, sizeof(TraceThread), PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) return NULL;
+
+    TraceThread *thread = memory;
+    thread->lock = (Lock)LOCK_INITIALIZER;
+    thread->chunk.thread = __atomic_fetch_add(&thread_count, 1, __ATOMIC_RELAXED);
+
+    lock_acquire(&threads_lock);
+    thread->next = threads;
+    threads = thread;
+    lock_release(&threads_lock);
+
+    trace_thread = thread;
+    pthread_setspecific(thread_key, thread);
+    return thread;
+}
+
+static uint8_t *put_varint(uint8_t *out, uint64_t value) {
+    while (value >= 0x80) {
+        *out++ = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    *out++ = (uint8_t)value;
+    return out;
+}
+
+void trace_record(TraceOp op, size_t size, void *ptr, void *old_ptr) {
+    TraceThread *thread = get_thread();
+    if (!thread) return;
+
+    lock_acquire(&thread->lock);
+    uint64_t timestamp = latency_ticks() - trace_start;
+    uint64_t address = (uint64_t)(uintptr_t)ptr;
+
+    if (!thread->chunk.count) {
+        thread->chunk.base = timestamp;
+        thread->last_timestamp = timestamp;
+        thread->last_ptr = 0;
+    }
+
+    uint8_t *out = thread->data + thread->chunk.bytes;
+    *out++ = (uint8_t)op;
+    out = put_varint(out, timestamp - thread->last_timestamp);
+    if (op != TRACE_FREE) out = put_varint(out, size);
+    out = put_varint(out, trace_zigzag(address - thread->last_ptr));
+    if (op == TRACE_REALLOC) out = put_varint(out, trace_zigzag((uint64_t)(uintptr_t)old_ptr - address));
+
+    thread->last_timestamp = timestamp;
+    thread->last_ptr = address;
+    thread->chunk.bytes = (uint32_t)(out - thread->data);
+    thread->chunk.count++;
+
+    if (thread->chunk.bytes > TRACE_BUFFER_SIZE - TRACE_RECORD_MAX_SIZE) flush_thread(thread);
+    lock_release(&thread->lock);
+}
+
+// FT_MALLOC_TRACE=<path> records every malloc, free and realloc of the
+// process to <path>.<pid>.trace
+void trace_init(void) {
+    const char *prefix = getenv("FT_MALLOC_TRACE");
+    char path[4096];
+    size_t length = 0;
+
+    if (!prefix) return;
+    while (prefix[length]) length++;
+    if (length + 32 > sizeof(path)) return;
+
+    ft_memcpy(path, prefix, length);
+    path[length++] = '.';
+    length += format_u64(path + length, (uint64_t)getpid());
+    ft_memcpy(path + length, ".trace", 7);
+
+    trace_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+    if (trace_fd < 0) return;
+
+    TraceHeader header;
+    ft_memset(&header, 0, sizeof(header));
+    ft_memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+    header.version = TRACE_VERSION;
+    header.chunk_size = sizeof(TraceChunk);
+    if (write(trace_fd, &header, sizeof(header)) != sizeof(header) ||
+        pthread_key_create(&thread_key, exit_thread) != 0) {
+        close(trace_fd);
+        trace_fd = -1;
+        return;
+    }
+
+    trace_start = latency_ticks();
+    __atomic_store_n(&trace_active, true, __ATOMIC_RELEASE);
+}
+
+// Threads still running at exit are flushed on their behalf; anything they
+// record after this point is lost
+__attribute__((destructor))
+static void trace_exit(void) {
+    if (!trace_enabled()) return;
+
+    __atomic_store_n(&trace_active, false, __ATOMIC_RELAXED);
+    lock_acquire(&threads_lock);
+    for (TraceThread *thread = threads; thread; thread = thread->next) {
+        lock_acquire(&thread->lock);
+        flush_thread(thread);
+        lock_release(&thread->lock);
+    }
+    lock_release(&threads_lock);
+}
@@ -0,0 +1,93 @@
+#include "writer.h"
+
+#include <errno.h>
+#include <unistd.h>
+
+void writer_init(Writer *writer, int fd, char *buffer, size_t capacity) {
+    writer->fd = fd;
+    writer->buffer = buffer;
+    writer->capacity = capacity;
+    writer->length = 0;
+    writer->failed = false;
+}
+
+static bool write_all(int fd, const char *data, size_t size) {
+    while (size > 0) {
+        ssize_t written = write(fd, data, size);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        data += written;
+        size -= (size_t)written;
+    }
+    return true;
+}
+
+bool writer_flush(Writer *writer) {
+    if (writer->length && !writer->failed) {
+        writer->failed = !write_all(writer->fd, writer->buffer, writer->length);
+    }
+    writer->length = 0;
+    return !writer->failed;
+}
+
+void write_bytes(Writer *writer, const void *data, size_t size) {
+    const char *bytes = data;
+
+    if (size >= writer->capacity) {
+        writer_flush(writer);
+        if (!writer->failed) writer->failed = !write_all(writer->fd, bytes, size);
+        return;
+    }
+    if (writer->length + size > writer->capacity) writer_flush(writer);
+
+    for (size_t i = 0; i < size; i++) {
+        writer->buffer[writer->length + i] = bytes[i];
+    }
+    writer->length += size;
+}
+
+void write_str(Writer *writer, const char *str) {
+    size_t size = 0;
+    while (str[size]) size++;
+    write_bytes(writer, str, size);
+}
+
+void write_char(Writer *writer, char c) {
+    write_bytes(writer, &c, 1);
+}
+
+// Writes the decimal digits of value without a terminator; buffer must hold
+// at least 20 bytes
+size_t format_u64(char *buffer, uint64_t value) {
+    char digits[20];
+    size_t count = 0;
+
+    do {
+        digits[sizeof(digits) - ++count] = (char)('0' + value % 10);
+        value /= 10;
+    } while (value);
+
+    for (size_t i = 0; i < count; i++) buffer[i] = digits[sizeof(digits) - count + i];
+    return count;
+}
+
+void write_u64(Writer *writer, uint64_t value) {
+    char digits[20];
+    write_bytes(writer, digits, format_u64(digits, value));
+}
+
+void write_hex(Writer *writer, uint64_t value) {
+    static const char hex_digits[] = "0123456789abcdef";
+    char digits[18];
+    size_t count = 0;
+
+    do {
+        digits[sizeof(digits) - ++count] = hex_digits[value & 0xF];
+        value >>= 4;
+    } while (value);
+    digits[sizeof(digits) - ++count] = 'x';
+    digits[sizeof(digits) - ++count] = '0';
+    write_bytes(writer, digits + sizeof(digits) - count, count);
+}
@@ -1,13 +1,24 @@
+#define _GNU_SOURCE
+#include <elf.h>
+#include <fcntl.h>
+#include <link.h>
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <pthread.h>
 #include <sys/time.h>
 #include <assert.h>
 #include <errno.h>
 #include <stdint.h>
 #include <limits.h>
+#include <stdlib.h>
+#include "libft.h"
 #include "malloc.h"
+#include "internal.h"
+#include "bitmap.h"
+#include "probe.h"
 
 // Colors for output
 #define GREEN "\033[0;32m"
@@ -43,6 +54,54 @@ void test_result(const char* test_name, int passed) {
     }
 }
 
+// Runs before anything else allocates: heaps are set up by the first
+// allocation of their class, not by a constructor
+void test_bootstrap() {
+    ft_printf("\n%s=== BOOTSTRAP TESTS ===%s\n", BLUE, RESET);
+
+    MallocStats stats;
+    malloc_get_stats(&stats);
+    test_result("No zone is mapped before the first allocation", stats.total.zones == 0 && stats.total.mapped == 0);
+
+    void *ptr = malloc(100);
+    malloc_get_stats(&stats);
+    test_result("The first allocation maps only its own class",
+                ptr && stats.classes[TINY].zones == 1 && stats.classes[SMALL].zones == 0 &&
+                stats.classes[LARGE].zones == 0);
+    free(ptr);
+}
+
+// 4040 bytes fill a whole 4096-byte block, which is too large for the fast
+// bins, so freeing it coalesces at once
+#define GROWTH_BLOCK 4040
+#define GROWTH_SLOTS 1024
+
+void test_zone_growth() {
+    ft_printf("\n%s=== ZONE GROWTH TESTS ===%s\n", BLUE, RESET);
+
+    static void *blocks[GROWTH_SLOTS];
+    size_t deltas[2] = {0, 0};
+    int grown = 0, count = 0;
+    MallocStats before, after;
+
+    malloc_get_stats(&before);
+    while (grown < 2 && count < GROWTH_SLOTS) {
+        blocks[count++] = malloc(GROWTH_BLOCK);
+        malloc_get_stats(&after);
+        if (after.classes[SMALL].zones > before.classes[SMALL].zones) {
+            deltas[grown++] = after.classes[SMALL].mapped - before.classes[SMALL].mapped;
+            before = after;
+        }
+    }
+    test_result("Each new zone of a class is larger than the last", grown == 2 && deltas[1] > deltas[0]);
+
+    malloc_get_stats(&before);
+    for (int i = 0; i < count; i++) free(blocks[i]);
+    malloc_get_stats(&after);
+    test_result("Empty zones are released but one spare",
+                after.classes[SMALL].zones <= 1 && after.classes[SMALL].zones < before.classes[SMALL].zones);
+}
+
 // Basic allocation tests
 void test_basic_allocation() {
     ft_printf("\n%s=== BASIC ALLOCATION TESTS ===%s\n", BLUE, RESET);
@@ -197,6 +256,60 @@ void test_fragmentation() {
         if (ptrs[i]) free(ptrs[i]);
     }
     free(ptrs);
+
+    // A hole between live blocks is found again by size, however many
+    // other holes and zones there are
+    void *small[256];
+    for (int i = 0; i < 256; i++) small[i] = malloc(1000);
+    for (int i = 1; i < 256; i += 4) {
+        free(small[i]);
+        small[i] = NULL;
+    }
+    void *hole = small[127];
+    free(hole);
+    small[127] = malloc(1000);
+    test_result("A hole of the exact size is reused", small[127] == hole);
+    for (int i = 0; i < 256; i++) free(small[i]);
+
+    // Freed blocks wait unmerged in a bin of their size, newest first
+    char *older = malloc(1000);
+    char *newer = malloc(1000);
+    free(older);
+    free(newer);
+    char *again = malloc(1000);
+    test_result("A freed block comes back without a merge", again == newer);
+    free(again);
+
+    // Past FAST_BIN_MAX_BYTES the fast bins are merged back, so freeing a
+    // run of neighbours leaves far fewer free blocks than it freed
+    HeapReport report;
+    char *run[128];
+    for (int i = 0; i < 128; i++) run[i] = malloc(1000);
+    char *guard = malloc(1000);
+    malloc_heap_report(&report);
+    size_t free_blocks = report.classes[SMALL].free_blocks;
+    for (int i = 0; i < 128; i++) free(run[i]);
+    malloc_heap_report(&report);
+    test_result("Fast-binned neighbours merge past the bin limit",
+                report.classes[SMALL].free_blocks < free_blocks + 128 / 2 + 8);
+    free(guard);
+
+    // Against a bit-by-bit scan, from every start and across word and
+    // vector boundaries
+    uint64_t words[HEAP_BIN_WORDS];
+    int scans_match = 1;
+    for (int round = 0; round < 200 && scans_match; round++) {
+        memset(words, 0, sizeof(words));
+        for (int bits = rand() % 4; bits > 0; bits--) bitmap_set(words, rand() % HEAP_BINS);
+        for (int from = 0; from <= HEAP_BINS; from++) {
+            int expected = -1;
+            for (int bit = from; bit < HEAP_BINS && expected < 0; bit++) {
+                if (bitmap_test(words, bit)) expected = bit;
+            }
+            if (bitmap_first_set(words, HEAP_BIN_WORDS, from) != expected) scans_match = 0;
+        }
+    }
+    test_result("bitmap_first_set finds the next set bit", scans_match);
 }
 
 pthread_mutex_t rand_lock = PTHREAD_MUTEX_INITIALIZER;
@@ -296,6 +409,144 @@ void test_concurrent_malloc() {
     test_result("Concurrent malloc success rate > 90%", success_rate > 0.9);
 }
 
+// Every acquisition of a class lock is counted, and a waiter spins at least
+// once before it can park
+void test_lock() {
+    ft_printf("\n%s=== LOCK TESTS ===%s\n", BLUE, RESET);
+
+    LockStats before, after;
+    malloc_lock_stats(SMALL, &before);
+    for (int i = 0; i < 1000; i++) free(malloc(2000));
+    malloc_lock_stats(SMALL, &after);
+    test_result("Each malloc and free takes the class lock",
+                after.acquisitions - before.acquisitions >= 2000);
+
+    pthread_t threads[NUM_THREADS];
+    thread_data_t thread_data[NUM_THREADS];
+    for (int i = 0; i < NUM_THREADS; i++) {
+        thread_data[i].thread_id = i + 1;
+        thread_data[i].success_count = 0;
+        thread_data[i].fail_count = 0;
+        pthread_create(&threads[i], NULL, thread_malloc_test, &thread_data[i]);
+    }
+    int failures = 0;
+    for (int i = 0; i < NUM_THREADS; i++) {
+        pthread_join(threads[i], NULL);
+        failures += thread_data[i].fail_count;
+    }
+    malloc_lock_stats(SMALL, &after);
+    test_result("Contended acquisitions stay consistent",
+                !failures && after.contended <= after.acquisitions && after.spins >= after.contended);
+}
+
+// Each size class has its own lock, so traffic in one class never touches
+// another class's lock
+void test_class_locks() {
+    ft_printf("\n%s=== CLASS LOCK TESTS ===%s\n", BLUE, RESET);
+
+    LockStats tiny_before, tiny_after, small_before, small_after;
+    malloc_lock_stats(TINY, &tiny_before);
+    for (int i = 0; i < 1000; i++) free(malloc(2000));
+    malloc_lock_stats(TINY, &tiny_after);
+    test_result("SMALL traffic leaves the TINY lock alone",
+                tiny_after.acquisitions == tiny_before.acquisitions);
+
+    malloc_lock_stats(SMALL, &small_before);
+    for (int i = 0; i < 100; i++) free(malloc(1 << 20));
+    malloc_lock_stats(SMALL, &small_after);
+    test_result("LARGE traffic leaves the SMALL lock alone",
+                small_after.acquisitions == small_before.acquisitions);
+}
+
+// Latency is only recorded when both the library and this test are built
+// with -DMALLOC_LATENCY=1, as make test-latency does
+void test_latency() {
+    ft_printf("\n%s=== LATENCY TESTS ===%s\n", BLUE, RESET);
+
+    MallocLatency before, after;
+    malloc_get_latency(&before);
+    for (int i = 0; i < 1000; i++) free(malloc(2000));
+    malloc_get_latency(&after);
+
+    LatencyHistogram *mallocs = &after.ops[LATENCY_MALLOC][SMALL];
+    LatencyHistogram *frees = &after.ops[LATENCY_FREE][SMALL];
+#if MALLOC_LATENCY
+    test_result("Each malloc and free is timed",
+                mallocs->count - before.ops[LATENCY_MALLOC][SMALL].count >= 1000 &&
+                frees->count - before.ops[LATENCY_FREE][SMALL].count >= 1000);
+
+    size_t p50 = malloc_latency_percentile(mallocs, 500);
+    size_t p99 = malloc_latency_percentile(mallocs, 990);
+    size_t p999 = malloc_latency_percentile(mallocs, 999);
+    test_result("Percentiles are ordered and bounded by the maximum",
+                p50 > 0 && p50 <= p99 && p99 <= p999 && p999 / 2 <= mallocs->max);
+#else
+    test_result("Timing is compiled out",
+                mallocs->count == 0 && frees->count == 0 && malloc_latency_percentile(mallocs, 500) == 0);
+#endif
+}
+
+// Tracers find probe sites through the library's .note.stapsdt entries, the
+// ones readelf -n lists, so every site must have one under ft_malloc
+static const char *probe_names[] = {"malloc_entry", "malloc_return", "free_entry", "free_return",
+                                    "realloc_entry", "realloc_return", "zone_map", "zone_unmap",
+                                    "coalesce", "lock_acquired", "lock_contended"};
+#define PROBE_COUNT (int)(sizeof(probe_names) / sizeof(*probe_names))
+
+static int find_library(struct dl_phdr_info *info, size_t size, void *path) {
+    (void)size;
+    if (!strstr(info->dlpi_name, "libft_malloc")) return 0;
+    *(const char **)path = info->dlpi_name;
+    return 1;
+}
+
+void test_probes() {
+    ft_printf("\n%s=== PROBE TESTS ===%s\n", BLUE, RESET);
+
+    const char *path = NULL;
+    struct stat info;
+    dl_iterate_phdr(find_library, &path);
+    int fd = path ? open(path, O_RDONLY) : -1;
+    char *file = (fd >= 0 && fstat(fd, &info) == 0) ? mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0)
+                                                    : MAP_FAILED;
+    if (fd >= 0) close(fd);
+    test_result("Library file is found and mapped", file != MAP_FAILED);
+    if (file == MAP_FAILED) return;
+
+    Elf64_Ehdr *header = (Elf64_Ehdr *)file;
+    Elf64_Shdr *sections = (Elf64_Shdr *)(file + header->e_shoff);
+    const char *section_names = file + sections[header->e_shstrndx].sh_offset;
+    int notes = 0, foreign = 0, found[PROBE_COUNT] = {0};
+
+    for (int i = 0; i < header->e_shnum; i++) {
+        if (sections[i].sh_type != SHT_NOTE || strcmp(section_names + sections[i].sh_name, ".note.stapsdt")) continue;
+
+        for (size_t offset = 0; offset + sizeof(Elf64_Nhdr) <= sections[i].sh_size;) {
+            Elf64_Nhdr *note = (Elf64_Nhdr *)(file + sections[i].sh_offset + offset);
+            const char *owner = (const char *)(note + 1);
+            const char *provider = owner + ((note->n_namesz + 3) & ~3u) + 3 * sizeof(uint64_t);
+            const char *name = provider + strlen(provider) + 1;
+
+            notes++;
+            if (note->n_type != 3 || strcmp(owner, "stapsdt") || strcmp(provider, "ft_malloc")) foreign++;
+            for (int j = 0; j < PROBE_COUNT; j++) {
+                if (!strcmp(name, probe_names[j])) found[j] = 1;
+            }
+            offset += sizeof(Elf64_Nhdr) + ((note->n_namesz + 3) & ~3u) + ((note->n_descsz + 3) & ~3u);
+        }
+    }
+    munmap(file, (size_t)info.st_size);
+
+    int missing = 0;
+    for (int j = 0; j < PROBE_COUNT; j++) missing += !found[j];
+#if PROBE_NOTES
+    test_result("Every probe site has a stapsdt note", notes > 0 && !missing);
+    test_result("Every note is under the ft_malloc provider", !foreign);
+#else
+    test_result("Probes are compiled out", notes == 0 && missing == PROBE_COUNT);
+#endif
+}
+
 void test_realloc_scenarios() {
     ft_printf("\n%s=== REALLOC TESTS ===%s\n", BLUE, RESET);
 
@@ -334,6 +585,22 @@ void test_realloc_scenarios() {
             free(ptr);
         }
     }
+
+    // Test 5: Moves large enough for the streaming copy, from odd offsets
+    int preserved = 1;
+    size_t sizes[] = {4 << 20, (8 << 20) + 13};
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        unsigned char *buffer = malloc(sizes[i]);
+        if (!buffer) continue;
+        for (size_t j = 0; j < sizes[i]; j++) buffer[j] = (unsigned char)(j * 7 + i);
+        buffer = realloc(buffer, sizes[i] * 2);
+        for (size_t j = 0; buffer && j < sizes[i]; j++) {
+            if (buffer[j] != (unsigned char)(j * 7 + i)) preserved = 0;
+        }
+        if (!buffer) preserved = 0;
+        free(buffer);
+    }
+    test_result("Large realloc moves preserve data", preserved);
 }
 
 void test_memory_patterns() {
@@ -386,6 +653,220 @@ void test_memory_patterns() {
     test_result("Power-of-2 size allocations", success_count > 18);
 }
 
+// Looks up the zone holding ptr in a snapshot, giving its base and the
+// payload of its first block
+static int find_zone(void *ptr, uint64_t *base, uint64_t *first) {
+    FILE *file = tmpfile();
+    SnapshotHeader header;
+    int found = 0;
+
+    if (!file || malloc_snapshot(fileno(file), 0) != 0 || lseek(fileno(file), 0, SEEK_SET) != 0 ||
+        read(fileno(file), &header, sizeof(header)) != sizeof(header)) {
+        if (file) fclose(file);
+        return 0;
+    }
+    for (uint64_t z = 0; z < header.zone_count && !found; z++) {
+        SnapshotZone zone;
+        if (read(fileno(file), &zone, sizeof(zone)) != sizeof(zone)) break;
+        for (uint32_t b = 0; b < zone.block_count; b++) {
+            SnapshotBlock record;
+            if (read(fileno(file), &record, sizeof(record)) != sizeof(record)) break;
+            if (b == 0) *first = record.address;
+        }
+        *base = zone.address;
+        found = (uintptr_t)ptr >= zone.address && (uintptr_t)ptr < zone.address + zone.size;
+    }
+    fclose(file);
+    return found;
+}
+
+void test_usable_size() {
+    ft_printf("\n%s=== USABLE SIZE AND OWNERSHIP ===%s\n", BLUE, RESET);
+
+    size_t sizes[] = {1, 24, 100, 256, 1000, 4000, 5000, 100000};
+    int covers = 1, writable = 1;
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        char *ptr = malloc(sizes[i]);
+        char *next = malloc(sizes[i]);
+        size_t usable = malloc_usable_size(ptr);
+
+        if (usable < sizes[i]) covers = 0;
+        // The whole usable size belongs to the block
+        memset(next, 0x11, sizes[i]);
+        memset(ptr, 0x22, usable);
+        if (next[0] != 0x11 || next[sizes[i] - 1] != 0x11) writable = 0;
+        free(ptr);
+        free(next);
+    }
+    test_result("Usable size covers the request", covers);
+    test_result("Usable slack is writable", writable);
+
+    int local = 0;
+    static int global;
+    char *ptr = malloc(64);
+    test_result("Owns its own blocks", ft_malloc_owns(ptr) && ft_malloc_owns(ptr + 10));
+    test_result("Foreign pointers are not owned",
+                !ft_malloc_owns(&local) && !ft_malloc_owns(&global) && !ft_malloc_owns(NULL) &&
+                !ft_malloc_owns((void *)test_result));
+    test_result("Usable size of a foreign pointer is 0",
+                malloc_usable_size(&local) == 0 && malloc_usable_size(NULL) == 0);
+    free(ptr);
+
+    // Overrunning a block cannot reach its zone's descriptor: the bytes in
+    // front of a zone's first block are only colouring, and may be trashed
+    char *block = malloc(1000);
+    uint64_t base = 0, first = 0;
+    size_t gap = find_zone(block, &base, &first) ? (size_t)(first - base) - sizeof(Block) : SIZE_MAX;
+    test_result("Zone descriptors live outside user pages",
+                gap % CACHE_LINE_SIZE == 0 && gap < ZONE_COLORS * CACHE_LINE_SIZE);
+    if (gap != SIZE_MAX) memset((void *)(uintptr_t)base, 0xA5, gap);
+    free(block);
+    block = malloc(1000);
+    MallocStats stats;
+    malloc_get_stats(&stats);
+    test_result("Overwriting the zone colouring is harmless",
+                block && ft_malloc_owns(block) && stats.classes[SMALL].in_use >= 1000);
+    free(block);
+
+    void *large = malloc(1 << 20);
+    uintptr_t address = (uintptr_t)large;
+    free(large);
+    test_result("Unmapped zones are no longer owned", !ft_malloc_owns((void *)address));
+}
+
+void test_arena() {
+    ft_printf("\n%s=== ARENA TESTS ===%s\n", BLUE, RESET);
+
+    Arena *arena = arena_create(0);
+    test_result("Arena creation", arena != NULL);
+    if (!arena) return;
+
+    // Enough to spill over several zones, plus one larger than a zone
+    char *first = arena_alloc(arena, 24);
+    int aligned = 1, intact = 1;
+    char *ptrs[1000];
+    for (int i = 0; i < 1000; i++) {
+        ptrs[i] = arena_alloc(arena, 200 + i % 7);
+        if (!ptrs[i] || (uintptr_t)ptrs[i] % 16) aligned = 0;
+        else memset(ptrs[i], i % 256, 200);
+    }
+    char *big = arena_alloc(arena, 3 * ARENA_ZONE_SIZE);
+    if (big) memset(big, 0x5A, 3 * ARENA_ZONE_SIZE);
+    for (int i = 0; i < 1000; i++) {
+        if (ptrs[i] && (unsigned char)ptrs[i][199] != i % 256) intact = 0;
+    }
+    test_result("Arena allocations are aligned", first && aligned);
+    test_result("Arena allocations do not overlap", intact && big && big[3 * ARENA_ZONE_SIZE - 1] == 0x5A);
+    test_result("Zero-size arena allocation", arena_alloc(arena, 0) == NULL);
+
+    arena_reset(arena);
+    test_result("Reset rewinds to the first allocation", arena_alloc(arena, 24) == first);
+
+    // After a reset the same workload runs on the zones already mapped
+    int reused = 1;
+    for (int i = 0; i < 1000; i++) {
+        if (!arena_alloc(arena, 200 + i % 7)) reused = 0;
+    }
+    test_result("Allocation after reset", reused);
+
+    Zone *zones[64];
+    int zone_count = 0;
+    for (Zone *zone = arena->zones; zone && zone_count < 64; zone = zone->next) zones[zone_count++] = zone;
+    for (Zone *zone = arena->spare; zone && zone_count < 64; zone = zone->next) zones[zone_count++] = zone;
+
+    arena_destroy(arena);
+    Arena *again = arena_create(0);
+    int recycled = 0;
+    for (int i = 0; again && i < zone_count; i++) {
+        if (zones[i] == again->home) recycled = 1;
+    }
+    test_result("Destroyed arena zones are recycled", recycled);
+
+    // msync() fails with ENOMEM once a page is no longer mapped
+    uintptr_t page = (uintptr_t)again & ~(uintptr_t)(getpagesize() - 1);
+    arena_destroy(again);
+    int trimmed = malloc_trim(0);
+    test_result("malloc_trim unmaps recycled arena zones",
+                trimmed == 1 && msync((void *)page, (size_t)getpagesize(), MS_ASYNC) == -1 && errno == ENOMEM);
+}
+
+void test_extended_api() {
+    ft_printf("\n%s=== EXTENDED API TESTS ===%s\n", BLUE, RESET);
+
+    size_t alignments[] = {32, 64, 256, 4096, 65536};
+    size_t sizes[] = {1, 100, 1000, 5000, 100000};
+    int aligned = 1;
+    for (size_t i = 0; i < sizeof(alignments) / sizeof(alignments[0]); i++) {
+        for (size_t j = 0; j < sizeof(sizes) / sizeof(sizes[0]); j++) {
+            char *ptr = mallocx(sizes[j], MALLOCX_ALIGN(alignments[i]));
+            if (!ptr || (uintptr_t)ptr % alignments[i] || malloc_usable_size(ptr) < sizes[j]) aligned = 0;
+            else memset(ptr, 0x33, sizes[j]);
+            dallocx(ptr, 0);
+        }
+    }
+    test_result("mallocx honours the alignment", aligned);
+
+    // Dirty the blocks first, so zeroing cannot come from fresh pages
+    int zeroed = 1;
+    for (size_t j = 0; j < sizeof(sizes) / sizeof(sizes[0]); j++) {
+        char *dirty = malloc(sizes[j]);
+        memset(dirty, 0xAB, malloc_usable_size(dirty));
+        free(dirty);
+
+        char *ptr = mallocx(sizes[j], MALLOCX_ZERO);
+        for (size_t k = 0; ptr && k < malloc_usable_size(ptr); k++) {
+            if (ptr[k]) zeroed = 0;
+        }
+        if (!ptr) zeroed = 0;
+        free(ptr);
+    }
+    test_result("MALLOCX_ZERO zeroes the usable size", zeroed);
+
+    // Shrinking leaves a free block behind, which growing takes back
+    char *block = mallocx(3000, MALLOCX_NO_CACHE);
+    memset(block, 0x44, 3000);
+    size_t shrunk = xallocx(block, 1000, 0, 0);
+    size_t grown = xallocx(block, 2500, 100, MALLOCX_ZERO);
+    test_result("xallocx resizes in place", shrunk >= 1000 && shrunk < 3000 && grown >= 2600 &&
+                grown == malloc_usable_size(block) && block[999] == 0x44 && block[grown - 1] == 0);
+    test_result("xallocx stays within the size class", xallocx(block, 100000, 0, 0) == grown);
+    free(block);
+
+    char *ptr = malloc(100);
+    memset(ptr, 0x55, 100);
+    char *moved = rallocx(ptr, 2000, MALLOCX_ALIGN(512) | MALLOCX_ZERO);
+    test_result("rallocx moves to honour the alignment",
+                moved && (uintptr_t)moved % 512 == 0 && moved[99] == 0x55 && moved[1999] == 0);
+    free(moved);
+
+    void *memptr = NULL;
+    int result = posix_memalign(&memptr, 128, 300);
+    void *aligned_ptr = aligned_alloc(1024, 1024);
+    test_result("posix_memalign and aligned_alloc",
+                result == 0 && (uintptr_t)memptr % 128 == 0 && ft_malloc_owns(memptr) &&
+                aligned_ptr && (uintptr_t)aligned_ptr % 1024 == 0 &&
+                posix_memalign(&memptr, 24, 300) == EINVAL);
+    free(memptr);
+    free(aligned_ptr);
+
+    int covered = 1;
+    for (size_t size = 1; size < 20000; size += 97) {
+        char *sized = mallocx(size, 0);
+        if (nallocx(size, 0) < size || nallocx(size, 0) > malloc_usable_size(sized)) covered = 0;
+        free(sized);
+    }
+    test_result("nallocx predicts the usable size", covered);
+
+    Arena *arena = arena_create(0);
+    int index = arena_index(arena);
+    char *in_arena = mallocx(100, MALLOCX_ARENA(index) | MALLOCX_ALIGN(64) | MALLOCX_ZERO);
+    int arena_ok = index >= 0 && in_arena && (uintptr_t)in_arena % 64 == 0 && !ft_malloc_owns(in_arena) &&
+                   in_arena[0] == 0 && in_arena[99] == 0;
+    arena_destroy(arena);
+    test_result("MALLOCX_ARENA allocates from the arena",
+                arena_ok && mallocx(100, MALLOCX_ARENA(index)) == NULL);
+}
+
 void print_summary() {
     ft_printf("\n%s=== TEST SUMMARY ===%s\n", BLUE, RESET);
     ft_printf("Total tests: %d\n", total_tests);
@@ -411,6 +892,8 @@ int main() {
     srand(time(NULL));
 
     // Run all test suites
+    test_bootstrap();
+    test_zone_growth();
     test_basic_allocation();
     test_edge_cases();
     test_alignment();
@@ -419,6 +902,13 @@ int main() {
     test_realloc_scenarios();
     test_memory_patterns();
     test_concurrent_malloc();
+    test_lock();
+    test_class_locks();
+    test_latency();
+    test_probes();
+    test_usable_size();
+    test_arena();
+    test_extended_api();
 
     // Print final summary
     print_summary();
@@ -0,0 +1,712 @@
+// test3.c
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include "libft.h"
+#include "malloc.h"
+#include "internal.h"
+#include "trace.h"
+
+// Colors for output
+#define GREEN  "\033[0;32m"
+#define RED    "\033[0;31m"
+#define YELLOW "\033[0;33m"
+#define BLUE   "\033[0;34m"
+#define RESET  "\033[0m"
+
+// Test statistics
+static int tests_passed = 0;
+static int tests_failed = 0;
+static int total_tests  = 0;
+
+#define COUNT 1000
+
+// ---------- Test result helpers ----------
+static void test_result(const char* test_name, int passed) {
+    total_tests++;
+    if (passed) {
+        ft_printf("[%sPASS%s] %s\n", GREEN, RESET, test_name);
+        tests_passed++;
+    } else {
+        ft_printf("[%sFAIL%s] %s\n", RED, RESET, test_name);
+        tests_failed++;
+    }
+}
+
+// ---------- Counters follow allocations ----------
+static void test_class_counters(void) {
+    ft_printf("\n%s=== CLASS COUNTERS ===%s\n", BLUE, RESET);
+
+    static void *ptrs[COUNT];
+    MallocStats before, during, after;
+
+    malloc_get_stats(&before);
+    for (int i = 0; i < COUNT; i++) ptrs[i] = malloc(32);
+    malloc_get_stats(&during);
+    for (int i = 0; i < COUNT; i++) free(ptrs[i]);
+    malloc_get_stats(&after);
+
+    ClassStats *b = &before.classes[TINY];
+    ClassStats *d = &during.classes[TINY];
+    ClassStats *a = &after.classes[TINY];
+
+    test_result("TINY allocation count grows by COUNT", d->allocations - b->allocations == COUNT);
+    test_result("TINY free count grows by COUNT", a->frees - d->frees == COUNT);
+    test_result("TINY bytes in use cover the allocations", d->in_use - b->in_use >= COUNT * 32);
+    test_result("TINY bytes in use return to baseline", a->in_use == b->in_use);
+    test_result("SMALL and LARGE untouched",
+                during.classes[SMALL].allocations == before.classes[SMALL].allocations &&
+                during.classes[LARGE].allocations == before.classes[LARGE].allocations);
+}
+
+static void test_large_mapping(void) {
+    ft_printf("\n%s=== LARGE MAPPING ===%s\n", BLUE, RESET);
+
+    MallocStats before, during, after;
+
+    malloc_get_stats(&before);
+    void *ptr = malloc(1024 * 1024);
+    malloc_get_stats(&during);
+    free(ptr);
+    malloc_get_stats(&after);
+
+    test_result("malloc(1MB) maps a LARGE zone",
+                during.classes[LARGE].zones == before.classes[LARGE].zones + 1 &&
+                during.classes[LARGE].mapped >= before.classes[LARGE].mapped + 1024 * 1024);
+    test_result("free(1MB) unmaps it again",
+                after.classes[LARGE].zones == before.classes[LARGE].zones &&
+                after.classes[LARGE].mapped == before.classes[LARGE].mapped);
+}
+
+static void test_totals(void) {
+    ft_printf("\n%s=== TOTALS ===%s\n", BLUE, RESET);
+
+    void *tiny = malloc(16);
+    void *small = malloc(2000);
+    void *large = malloc(100000);
+
+    MallocStats stats;
+    malloc_get_stats(&stats);
+
+    int consistent = 1;
+    size_t in_use = 0, mapped = 0;
+    for (int type = TINY; type <= LARGE; type++) {
+        ClassStats *c = &stats.classes[type];
+        if (c->in_use + c->free > c->mapped) consistent = 0;
+        if (c->fragmentation > 1000) consistent = 0;
+        in_use += c->in_use;
+        mapped += c->mapped;
+    }
+    test_result("Per-class bytes fit in mapped bytes", consistent);
+    test_result("Totals are the sum of classes",
+                stats.total.in_use == in_use && stats.total.mapped == mapped);
+    test_result("Lock counters see acquisitions", stats.locks[TINY].acquisitions > 0);
+
+    free(tiny);
+    free(small);
+    free(large);
+}
+
+// ---------- Polling while other threads allocate ----------
+static volatile int stop_polling = 0;
+
+static void *poll_thread(void *arg) {
+    size_t *polls = (size_t *)arg;
+    MallocStats stats;
+
+    while (!stop_polling) {
+        malloc_get_stats(&stats);
+        __atomic_fetch_add(polls, 1, __ATOMIC_RELAXED);
+    }
+    return NULL;
+}
+
+static void test_polling(void) {
+    ft_printf("\n%s=== POLLING UNDER LOAD ===%s\n", BLUE, RESET);
+
+    pthread_t poller;
+    size_t polls = 0;
+    pthread_create(&poller, NULL, poll_thread, &polls);
+
+    for (int round = 0; round < 100; round++) {
+        void *ptrs[100];
+        for (int i = 0; i < 100; i++) ptrs[i] = malloc((size_t)(i * 37 % 3000) + 1);
+        for (int i = 0; i < 100; i++) free(ptrs[i]);
+    }
+
+    // On a single CPU the poller may not have run yet
+    while (!__atomic_load_n(&polls, __ATOMIC_RELAXED)) sched_yield();
+    stop_polling = 1;
+    pthread_join(poller, NULL);
+    test_result("Stats can be polled while allocating", polls > 0);
+}
+
+// ---------- Thread caches ----------
+#define CHURN_BLOCKS 6000
+
+static void *churn_thread(void *arg) {
+    static void *ptrs[CHURN_BLOCKS];
+    (void)arg;
+
+    for (int i = 0; i < CHURN_BLOCKS; i++) ptrs[i] = malloc(48);
+    for (int i = 0; i < CHURN_BLOCKS; i++) free(ptrs[i]);
+    return NULL;
+}
+
+// Two threads take turns allocating, each keeping its blocks
+#define TURN_BLOCKS 200
+
+static void *turn_blocks[2][TURN_BLOCKS];
+static volatile int turn;
+
+static void *turn_thread(void *arg) {
+    int id = (int)(intptr_t)arg;
+
+    for (int i = 0; i < TURN_BLOCKS; i++) {
+        while (__atomic_load_n(&turn, __ATOMIC_ACQUIRE) % 2 != id) sched_yield();
+        turn_blocks[id][i] = malloc(24 + (i % 3) * 40);
+        __atomic_store_n(&turn, turn + 1, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+// Cache lines spanned by a block, header included
+static void block_lines(void *ptr, uintptr_t *first, uintptr_t *last) {
+    *first = ((uintptr_t)ptr - 48) / CACHE_LINE_SIZE;
+    *last = ((uintptr_t)ptr + malloc_usable_size(ptr) - 1) / CACHE_LINE_SIZE;
+}
+
+static void test_thread_cache(void) {
+    ft_printf("\n%s=== THREAD CACHES ===%s\n", BLUE, RESET);
+
+    MallocStats before, after;
+    pthread_t thread;
+
+    // One empty zone may be kept as the class spare
+    malloc_get_stats(&before);
+    pthread_create(&thread, NULL, churn_thread, NULL);
+    pthread_join(thread, NULL);
+    malloc_get_stats(&after);
+    test_result("Exiting thread gives its zones back",
+                after.classes[TINY].zones <= before.classes[TINY].zones + 1 &&
+                after.classes[TINY].in_use == before.classes[TINY].in_use);
+
+    churn_thread(NULL);
+    malloc_thread_flush();
+    malloc_get_stats(&after);
+    test_result("malloc_thread_flush gives the caller's zones back",
+                after.classes[TINY].zones <= before.classes[TINY].zones + 1);
+
+    pthread_t turns[2];
+    for (intptr_t id = 0; id < 2; id++) pthread_create(&turns[id], NULL, turn_thread, (void *)id);
+    for (int id = 0; id < 2; id++) pthread_join(turns[id], NULL);
+    int shared = 0;
+    for (int i = 0; i < TURN_BLOCKS; i++) {
+        for (int j = 0; j < TURN_BLOCKS; j++) {
+            uintptr_t first0, last0, first1, last1;
+            block_lines(turn_blocks[0][i], &first0, &last0);
+            block_lines(turn_blocks[1][j], &first1, &last1);
+            if (first0 <= last1 && first1 <= last0) shared++;
+        }
+    }
+    for (int id = 0; id < 2; id++) {
+        for (int i = 0; i < TURN_BLOCKS; i++) free(turn_blocks[id][i]);
+    }
+    test_result("Threads allocating in turns share no cache line", shared == 0);
+
+    void *ptr = calloc(100, 8);
+    int zeroed = ptr != NULL;
+    for (int i = 0; zeroed && i < 800; i++) zeroed = ((char *)ptr)[i] == 0;
+    free(ptr);
+    test_result("calloc memory is zeroed", zeroed);
+    test_result("calloc overflow is rejected", calloc(SIZE_MAX / 2, 4) == NULL);
+
+    // A block handed out again by the cache is live to every entry point
+    char *first = malloc(40);
+    free(first);
+    char *again = malloc(40);
+    int live = again == first && malloc_usable_size(again) >= 40;
+    if (again) memset(again, 'c', 40);
+    char *grown = realloc(again, 200);
+    live = live && grown && memcmp(grown, "cccccccccccccccccccccccccccccccccccccccc", 40) == 0;
+    free(grown);
+    test_result("Blocks reused from the cache can be resized and freed", live);
+}
+
+// ---------- Returning memory ----------
+#define PURGE_BLOCKS 400
+
+static long resident_kb(void) {
+    char buffer[128] = {0};
+    int fd = open("/proc/self/statm", O_RDONLY);
+    if (fd < 0) return 0;
+    ssize_t length = read(fd, buffer, sizeof(buffer) - 1);
+    close(fd);
+
+    char *field = length > 0 ? strchr(buffer, ' ') : NULL;
+    return field ? atol(field + 1) * (sysconf(_SC_PAGESIZE) / 1024) : 0;
+}
+
+// Leaves one block in fifty allocated, so the zones stay mapped and only
+// purging can give their pages back
+static void fill_and_thin(void **ptrs) {
+    for (int i = 0; i < PURGE_BLOCKS; i++) {
+        ptrs[i] = malloc(4000);
+        memset(ptrs[i], 0x5A, 4000);
+    }
+    for (int i = 0; i < PURGE_BLOCKS; i++) {
+        if (i % 50) free(ptrs[i]);
+    }
+}
+
+static void test_purge(void) {
+    ft_printf("\n%s=== RETURNING MEMORY ===%s\n", BLUE, RESET);
+
+    static void *ptrs[PURGE_BLOCKS];
+
+    fill_and_thin(ptrs);
+    long before = resident_kb();
+    int trimmed = malloc_trim(0);
+    long after = resident_kb();
+    test_result("malloc_trim releases free pages", trimmed == 1 && after < before - 512);
+
+    int intact = 1;
+    for (int i = 0; i < PURGE_BLOCKS; i += 50) {
+        if (((unsigned char *)ptrs[i])[3999] != 0x5A) intact = 0;
+        free(ptrs[i]);
+    }
+    test_result("Live blocks survive trimming", intact);
+
+    malloc_set_purge_window(20);
+    fill_and_thin(ptrs);
+    before = resident_kb();
+    for (int i = 0; i < 50 && resident_kb() > before - 512; i++) usleep(10000);
+    after = resident_kb();
+    malloc_set_purge_window(0);
+    test_result("Background purger decays free pages", after < before - 512);
+
+    for (int i = 0; i < PURGE_BLOCKS; i += 50) free(ptrs[i]);
+}
+
+// ---------- Heap shape report ----------
+static void test_heap_report(void) {
+    ft_printf("\n%s=== HEAP REPORT ===%s\n", BLUE, RESET);
+
+    static void *ptrs[COUNT];
+    HeapReport before, during;
+
+    malloc_heap_report(&before);
+    for (int i = 0; i < COUNT; i++) ptrs[i] = malloc(33);
+    // Free every other block so the class has holes
+    for (int i = 0; i < COUNT; i += 2) free(ptrs[i]);
+    malloc_heap_report(&during);
+
+    ClassReport *b = &before.classes[TINY];
+    ClassReport *d = &during.classes[TINY];
+
+    test_result("Requested bytes match the allocations", d->requested - b->requested == COUNT / 2 * 33);
+    test_result("Rounding slack is counted as internal fragmentation",
+                d->in_use - d->requested >= (d->requested - b->requested) / 33 * 15 && d->internal > 0);
+    test_result("Holes show up as external fragmentation",
+                d->free_blocks >= COUNT / 2 && d->external > 0 && d->largest_free < d->free);
+
+    size_t zones = 0;
+    for (int i = 0; i < REPORT_OCCUPANCY_BUCKETS; i++) zones += d->occupancy[i];
+    test_result("Every zone is in the occupancy distribution", zones == d->zones);
+
+    int fds[2];
+    char json[8192] = {0};
+    if (pipe(fds) != 0) {
+        test_result("JSON report is written to a descriptor", 0);
+        return;
+    }
+    int written = malloc_heap_report_json(fds[1]);
+    close(fds[1]);
+    ssize_t length = read(fds[0], json, sizeof(json) - 1);
+    close(fds[0]);
+    test_result("JSON report is written to a descriptor",
+                written == 0 && length > 0 && json[0] == '{' && strstr(json, "\"TINY\"") &&
+                strstr(json, "\"external_permille\""));
+
+    for (int i = 1; i < COUNT; i += 2) free(ptrs[i]);
+}
+
+static void test_snapshot(void) {
+    ft_printf("\n%s=== HEAP SNAPSHOT ===%s\n", BLUE, RESET);
+
+    char *marker = malloc(64);
+    memcpy(marker, "snapshot-marker", 16);
+
+    FILE *file = tmpfile();
+    if (!file) {
+        test_result("Snapshot is written to a descriptor", 0);
+        free(marker);
+        return;
+    }
+    int fd = fileno(file);
+    test_result("Snapshot is written to a descriptor", malloc_snapshot(fd, SNAPSHOT_CONTENTS) == 0);
+
+    SnapshotHeader header;
+    off_t end = lseek(fd, 0, SEEK_END);
+    lseek(fd, 0, SEEK_SET);
+    test_result("Header describes the file",
+                read(fd, &header, sizeof(header)) == sizeof(header) &&
+                memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) == 0 && header.zone_count > 0 &&
+                (off_t)(sizeof(header) + header.zone_count * sizeof(SnapshotZone) +
+                        header.block_count * sizeof(SnapshotBlock) + header.content_bytes) == end);
+
+    // The marker's record gives its offset among the dumped payloads
+    off_t content = (off_t)(sizeof(header) + header.zone_count * sizeof(SnapshotZone) +
+                            header.block_count * sizeof(SnapshotBlock));
+    int found = 0;
+    for (uint64_t z = 0; z < header.zone_count && !found; z++) {
+        SnapshotZone zone;
+        if (read(fd, &zone, sizeof(zone)) != sizeof(zone)) break;
+        for (uint32_t b = 0; b < zone.block_count; b++) {
+            SnapshotBlock block;
+            if (read(fd, &block, sizeof(block)) != sizeof(block)) break;
+            if (block.status != SNAPSHOT_ALLOCATED) continue;
+            if (block.address == (uint64_t)(uintptr_t)marker) {
+                char bytes[16] = {0};
+                found = pread(fd, bytes, sizeof(bytes), content) == sizeof(bytes) &&
+                        memcmp(bytes, "snapshot-marker", 16) == 0;
+                break;
+            }
+            content += (off_t)block.size;
+        }
+    }
+    test_result("Allocated block and its contents are in the snapshot", found);
+
+    fclose(file);
+    free(marker);
+}
+
+// ---------- Heap profile ----------
+#define PROF_TEST_RATE 4096
+#define PROF_TEST_BLOCKS 20000
+#define PROF_TEST_SIZE 64
+
+static void test_profile(void) {
+    ft_printf("\n%s=== HEAP PROFILE ===%s\n", BLUE, RESET);
+
+    // The file is opened first so that only the loop below is sampled
+    static void *ptrs[PROF_TEST_BLOCKS];
+    FILE *file = tmpfile();
+    malloc_prof_set_rate(PROF_TEST_RATE);
+    for (int i = 0; i < PROF_TEST_BLOCKS; i++) ptrs[i] = malloc(PROF_TEST_SIZE);
+
+    int dumped = file && malloc_prof_dump(fileno(file)) == 0;
+    malloc_prof_set_rate(0);
+    test_result("Profile is written to a descriptor", dumped);
+
+    static char text[65536];
+    ssize_t length = 0;
+    if (dumped) {
+        lseek(fileno(file), 0, SEEK_SET);
+        length = read(fileno(file), text, sizeof(text) - 1);
+    }
+    text[length > 0 ? length : 0] = '\0';
+
+    // One sample is expected every PROF_TEST_RATE bytes on average
+    size_t live_count = 0, live_bytes = 0, alloc_count = 0, alloc_bytes = 0, rate = 0;
+    int fields = sscanf(text, "heap profile: %zu: %zu [%zu: %zu] @ heap_v2/%zu", &live_count, &live_bytes,
+                        &alloc_count, &alloc_bytes, &rate);
+    size_t expected = (size_t)PROF_TEST_BLOCKS * PROF_TEST_SIZE / PROF_TEST_RATE;
+    test_result("Header is in heap_v2 format", fields == 5 && rate == PROF_TEST_RATE);
+    test_result("Sampling follows the configured rate",
+                live_count >= expected / 2 && live_count <= expected * 2 &&
+                live_bytes == live_count * PROF_TEST_SIZE);
+
+    // The busiest stack is the loop above, so its first frame must be in this
+    // program rather than in the allocator
+    size_t best_count = 0;
+    void *best_pc = NULL;
+    for (char *line = strchr(text, '\n'); line && line[1] && line[1] != '\n'; line = strchr(line + 1, '\n')) {
+        size_t count;
+        void *pc;
+        char *at = strchr(line + 1, '@');
+        if (sscanf(line + 1, "%zu:", &count) == 1 && at && sscanf(at + 1, " %p", &pc) == 1 && count > best_count) {
+            best_count = count;
+            best_pc = pc;
+        }
+    }
+    Dl_info caller, here;
+    test_result("Stacks start at the caller of malloc",
+                best_pc && dladdr(best_pc, &caller) && dladdr((void *)test_profile, &here) &&
+                caller.dli_fbase == here.dli_fbase);
+    test_result("Mapped libraries follow the samples", strstr(text, "\nMAPPED_LIBRARIES:\n") != NULL);
+
+    // Each block freed here is handed straight back out by the thread cache,
+    // and its sample must still be dropped when it is freed for good
+    malloc_prof_set_rate(PROF_TEST_RATE);
+    for (int i = 0; i < PROF_TEST_BLOCKS; i++) {
+        free(ptrs[i]);
+        ptrs[i] = malloc(PROF_TEST_SIZE);
+    }
+    malloc_prof_set_rate(0);
+    for (int i = 0; i < PROF_TEST_BLOCKS; i++) free(ptrs[i]);
+
+    live_count = SIZE_MAX;
+    if (dumped && ftruncate(fileno(file), 0) == 0 && lseek(fileno(file), 0, SEEK_SET) == 0 &&
+        malloc_prof_dump(fileno(file)) == 0 && lseek(fileno(file), 0, SEEK_SET) == 0) {
+        length = read(fileno(file), text, sizeof(text) - 1);
+        text[length > 0 ? length : 0] = '\0';
+        sscanf(text, "heap profile: %zu:", &live_count);
+    }
+    test_result("Freed samples are dropped, cached blocks included", live_count == 0);
+
+    if (file) fclose(file);
+}
+
+// ---------- Real-time reserve ----------
+#define RESERVE_BLOCKS 96
+
+static void churn_reserve(void) {
+    void *ptrs[RESERVE_BLOCKS];
+    size_t sizes[] = {40, 1000, 100000};
+
+    for (int i = 0; i < RESERVE_BLOCKS; i++) {
+        ptrs[i] = malloc(sizes[i % 3]);
+        if (ptrs[i]) memset(ptrs[i], i, sizes[i % 3]);
+    }
+    for (int i = 0; i < RESERVE_BLOCKS; i++) free(ptrs[i]);
+}
+
+static long minor_faults(void) {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_minflt;
+}
+
+// Real-time mode cannot be left again, so it runs in a child, which
+// reports one bit per check through its exit status
+static int run_reserve_child(void) {
+    int bits = 0;
+    MallocStats before, after;
+
+    if (malloc_reserve(1 << 20, 4 << 20, 16 << 20, 0) != 0) return 0;
+    malloc_get_stats(&before);
+    if (before.classes[TINY].reserved >= 1 << 20 && before.classes[LARGE].reserved >= 16 << 20) bits |= 1;
+
+    // The first round also copies the pages shared with the parent
+    churn_reserve();
+    long faults = minor_faults();
+    churn_reserve();
+    faults = minor_faults() - faults;
+
+    errno = 0;
+    void *huge = malloc(32 << 20);
+    malloc_get_stats(&after);
+    if (faults <= 4 && after.total.mapped == before.total.mapped) bits |= 2;
+    if (!huge && errno == ENOMEM && after.classes[LARGE].exhausted == 1) bits |= 4;
+    if (after.classes[LARGE].peak >= RESERVE_BLOCKS / 3 * 100000) bits |= 8;
+    return bits;
+}
+
+#define PURGED_BLOCKS 150
+
+static int fill_small(void **ptrs) {
+    int filled = 0;
+
+    for (int i = 1; i < PURGED_BLOCKS; i++) {
+        ptrs[i] = malloc(3000);
+        if (ptrs[i]) memset(ptrs[i], i, 3000);
+        filled += ptrs[i] != NULL;
+    }
+    return filled == PURGED_BLOCKS - 1;
+}
+
+// The zone purged before the reserve is bigger than the reserve and keeps
+// serving the class, so it has to be made resident along with it. The first
+// block stays allocated, so trimming purges the zone instead of unmapping it.
+static int run_purged_reserve_child(void) {
+    static void *ptrs[PURGED_BLOCKS];
+
+    ptrs[0] = malloc(3000);
+    fill_small(ptrs);
+    for (int i = 1; i < PURGED_BLOCKS; i++) free(ptrs[i]);
+    if (!malloc_trim(0) || malloc_reserve(0, 64 << 10, 0, 0) != 0) return 0;
+
+    long faults = minor_faults();
+    int filled = fill_small(ptrs);
+    faults = minor_faults() - faults;
+    return filled && faults <= 4;
+}
+
+static void test_reserve(void) {
+    ft_printf("\n%s=== REAL-TIME RESERVE ===%s\n", BLUE, RESET);
+
+    int status = 0;
+    pid_t pid = fork();
+    if (pid == 0) _exit(run_reserve_child());
+    int bits = (pid > 0 && waitpid(pid, &status, 0) == pid && WIFEXITED(status)) ? WEXITSTATUS(status) : 0;
+
+    test_result("malloc_reserve maps the reserve", bits & 1);
+    test_result("No mapping or page faults inside the reserve", bits & 2);
+    test_result("An exhausted reserve fails fast", bits & 4);
+    test_result("Peak usage is tracked", bits & 8);
+
+    pid = fork();
+    if (pid == 0) _exit(run_purged_reserve_child());
+    bits = (pid > 0 && waitpid(pid, &status, 0) == pid && WIFEXITED(status)) ? WEXITSTATUS(status) : 0;
+    test_result("No page faults in zones purged before the reserve", bits & 1);
+}
+
+// ---------- Trace and replay ----------
+#define TRACE_PREFIX "/tmp/ft_malloc_test3"
+#define TRACE_PAIRS 1000
+#define TRACE_LATE_SIZE 12345
+
+static pthread_key_t late_key;
+
+// Created after the library's trace key, so it runs once the thread's trace
+// buffer is gone
+static void allocate_late(void *arg) {
+    (void)arg;
+    free(malloc(TRACE_LATE_SIZE));
+}
+
+static void *trace_worker(void *arg) {
+    (void)arg;
+    for (int i = 0; i < TRACE_PAIRS; i++) free(malloc((size_t)(i % 200) + 1));
+    pthread_setspecific(late_key, &late_key);
+    return NULL;
+}
+
+// Runs in a fresh process started with FT_MALLOC_TRACE set
+static int run_trace_child(void) {
+    pthread_t thread;
+
+    // The first malloc sets the library's keys up, before late_key
+    for (int i = 0; i < TRACE_PAIRS; i++) free(malloc((size_t)(i % 200) + 1));
+    pthread_key_create(&late_key, allocate_late);
+    if (pthread_create(&thread, NULL, trace_worker, NULL) != 0) return 1;
+    pthread_join(thread, NULL);
+    return 0;
+}
+
+static const uint8_t *read_varint(const uint8_t *in, const uint8_t *end, uint64_t *value) {
+    *value = 0;
+    for (int shift = 0; in < end && shift < 64; shift += 7) {
+        *value |= (uint64_t)(*in & 0x7F) << shift;
+        if (!(*in++ & 0x80)) return in;
+    }
+    return NULL;
+}
+
+// Counts the records of a trace file and the mallocs of the given size
+static size_t scan_trace(const char *path, size_t size, size_t *matches) {
+    static uint8_t data[1 << 20];
+    size_t records = 0;
+
+    int fd = open(path, O_RDONLY);
+    ssize_t length = fd >= 0 ? read(fd, data, sizeof(data)) : -1;
+    if (fd >= 0) close(fd);
+    if (length < (ssize_t)sizeof(TraceHeader)) return 0;
+
+    *matches = 0;
+    for (size_t offset = sizeof(TraceHeader); offset + sizeof(TraceChunk) <= (size_t)length;) {
+        TraceChunk chunk;
+        memcpy(&chunk, data + offset, sizeof(chunk));
+        const uint8_t *in = data + offset + sizeof(chunk);
+        const uint8_t *end = in + chunk.bytes;
+
+        for (uint32_t i = 0; i < chunk.count && in && in < end; i++) {
+            uint8_t op = *in++;
+            uint64_t value;
+            in = read_varint(in, end, &value);
+            if (in && op != TRACE_FREE) {
+                in = read_varint(in, end, &value);
+                if (op == TRACE_MALLOC && value == size) (*matches)++;
+            }
+            if (in) in = read_varint(in, end, &value);
+            if (in && op == TRACE_REALLOC) in = read_varint(in, end, &value);
+            records++;
+        }
+        offset += sizeof(chunk) + chunk.bytes;
+    }
+    return records;
+}
+
+static void test_trace(void) {
+    ft_printf("\n%s=== TRACE AND REPLAY ===%s\n", BLUE, RESET);
+
+    int status = 0;
+    pid_t pid = fork();
+    if (pid == 0) {
+        setenv("FT_MALLOC_TRACE", TRACE_PREFIX, 1);
+        execl("/proc/self/exe", "test3", "trace-child", (char *)NULL);
+        _exit(127);
+    }
+    int ran = pid > 0 && waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+
+    char path[64];
+    snprintf(path, sizeof(path), TRACE_PREFIX ".%d.trace", (int)pid);
+    size_t late = 0;
+    size_t records = ran ? scan_trace(path, TRACE_LATE_SIZE, &late) : 0;
+    test_result("Every malloc and free of each thread is recorded", records >= 4 * TRACE_PAIRS);
+    test_result("Nothing is recorded after the thread's trace buffer is gone", records && !late);
+
+    // The replay tool must read back exactly the recorded operations
+    char command[128];
+    snprintf(command, sizeof(command), "tools/replay %s 2>&1", path);
+    FILE *output = popen(command, "r");
+    size_t replayed = 0;
+    int skipped = 0;
+    char line[256];
+    while (output && fgets(line, sizeof(line), output)) {
+        sscanf(line, "records %zu", &replayed);
+        if (strncmp(line, "skipped", 7) == 0) skipped = 1;
+    }
+    int replay_status = output ? pclose(output) : -1;
+    test_result("tools/replay replays the whole trace",
+                replay_status == 0 && replayed == records && records && !skipped);
+    unlink(path);
+}
+
+// ---------- Summary ----------
+static void print_summary(void) {
+    ft_printf("\n%s=== TEST SUMMARY ===%s\n", BLUE, RESET);
+    ft_printf("Total tests: %d\n", total_tests);
+    ft_printf("Passed: %s%d%s\n", GREEN, tests_passed, RESET);
+    ft_printf("Failed: %s%d%s\n", RED, tests_failed, RESET);
+
+    if (tests_failed == 0) {
+        ft_printf("\n%s🎉 ALL TESTS PASSED! 🎉%s\n", GREEN, RESET);
+    } else {
+        ft_printf("\n%s⚠️  Some tests failed. Review the output above. ⚠️%s\n", YELLOW, RESET);
+    }
+}
+
+// ---------- Main ----------
+
+int main(int argc, char **argv) {
+    if (argc == 2 && strcmp(argv[1], "trace-child") == 0) return run_trace_child();
+
+    ft_printf("%s=== MALLOC STATISTICS TEST SUITE ===%s\n", BLUE, RESET);
+
+    test_class_counters();
+    test_large_mapping();
+    test_totals();
+    test_polling();
+    test_thread_cache();
+    test_purge();
+    test_heap_report();
+    test_snapshot();
+    test_profile();
+    test_reserve();
+    test_trace();
+
+    print_summary();
+    malloc_stats();
+    return (tests_failed > 0) ? 1 : 0;
+}
@@ -0,0 +1,291 @@
+// Replays a trace recorded with FT_MALLOC_TRACE against whichever malloc the
+// process runs with (LD_PRELOAD this library, or not for glibc). Records are
+// replayed on one thread in timestamp order, so every run is identical.
+//
+// Usage: replay <file.trace>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+#define RSS_SAMPLE_PERIOD 1024
+
+typedef struct Slot {
+    uint64_t id;
+    void *ptr;
+    size_t size;
+} Slot;
+
+typedef struct Replay {
+    Slot *slots;
+    size_t mask;
+    size_t live_bytes;
+    size_t peak_live_bytes;
+    size_t unknown_frees;
+    size_t reused_ids;
+    size_t failures;
+} Replay;
+
+static uint64_t now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+}
+
+// Current resident size from /proc/self/statm. ru_maxrss is a high-water
+// mark that already includes the trace and the decoded records, so it cannot
+// give the RSS the replay itself adds. Read with a kept-open fd, as fopen()
+// would allocate through the allocator under test.
+static long current_rss_kb(int statm_fd) {
+    char buffer[128];
+    ssize_t length = pread(statm_fd, buffer, sizeof(buffer) - 1, 0);
+    if (length <= 0) return 0;
+    buffer[length] = '\0';
+
+    char *field = strchr(buffer, ' ');
+    return field ? strtol(field + 1, NULL, 10) * (sysconf(_SC_PAGESIZE) / 1024) : 0;
+}
+
+// Helper memory comes from mmap so only the replayed operations go through
+// the allocator under test
+static void *map_memory(size_t size) {
+    void *memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return (memory == MAP_FAILED) ? NULL : memory;
+}
+
+static const uint8_t *get_varint(const uint8_t *in, const uint8_t *end, uint64_t *value) {
+    *value = 0;
+    for (int shift = 0; in < end && shift < 64; shift += 7) {
+        uint8_t byte = *in++;
+        *value |= (uint64_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) return in;
+    }
+    return NULL;
+}
+
+static size_t count_records(const char *data, size_t size) {
+    size_t count = 0;
+
+    for (size_t offset = 0; offset + sizeof(TraceChunk) <= size;) {
+        const TraceChunk *chunk = (const TraceChunk *)(data + offset);
+        count += chunk->count;
+        offset += sizeof(TraceChunk) + chunk->bytes;
+    }
+    return count;
+}
+
+// Returns the number of records decoded; a truncated final chunk, as left
+// by a process that was killed, ends the trace early
+static size_t decode_records(const char *data, size_t size, TraceRecord *records) {
+    size_t count = 0;
+
+    for (size_t offset = 0; offset + sizeof(TraceChunk) <= size;) {
+        const TraceChunk *chunk = (const TraceChunk *)(data + offset);
+        const uint8_t *in = (const uint8_t *)(chunk + 1);
+        const uint8_t *end = in + chunk->bytes;
+        uint64_t timestamp = chunk->base, ptr = 0, value;
+
+        offset += sizeof(TraceChunk) + chunk->bytes;
+        if (offset > size) break;
+
+        for (uint32_t i = 0; i < chunk->count && in && in < end; i++) {
+            TraceRecord *record = &records[count];
+            memset(record, 0, sizeof(TraceRecord));
+            record->op = *in++;
+            record->thread = chunk->thread;
+
+            if (!(in = get_varint(in, end, &value))) break;
+            timestamp += value;
+            record->timestamp = timestamp;
+            if (record->op != TRACE_FREE && !(in = get_varint(in, end, &record->size))) break;
+            if (!(in = get_varint(in, end, &value))) break;
+            ptr += trace_unzigzag(value);
+            record->ptr = ptr;
+            if (record->op == TRACE_REALLOC) {
+                if (!(in = get_varint(in, end, &value))) break;
+                record->old_ptr = ptr + trace_unzigzag(value);
+            }
+            count++;
+        }
+    }
+    return count;
+}
+
+static int compare_records(const void *a, const void *b) {
+    const TraceRecord *left = a, *right = b;
+
+    if (left->timestamp != right->timestamp) return (left->timestamp < right->timestamp) ? -1 : 1;
+    if (left->thread != right->thread) return (left->thread < right->thread) ? -1 : 1;
+    return 0;
+}
+
+static size_t hash_id(uint64_t id) {
+    return (size_t)((id >> 4) * 0x9E3779B97F4A7C15ULL >> 20);
+}
+
+static Slot *find_slot(Replay *replay, uint64_t id) {
+    size_t i = hash_id(id) & replay->mask;
+
+    while (replay->slots[i].id && replay->slots[i].id != id) i = (i + 1) & replay->mask;
+    return &replay->slots[i];
+}
+
+// Backward-shift deletion keeps probe chains short without tombstones
+static void remove_slot(Replay *replay, Slot *slot) {
+    size_t hole = (size_t)(slot - replay->slots);
+
+    for (size_t i = (hole + 1) & replay->mask; replay->slots[i].id; i = (i + 1) & replay->mask) {
+        size_t home = hash_id(replay->slots[i].id) & replay->mask;
+        int movable = (hole <= i) ? (home <= hole || home > i) : (home <= hole && home > i);
+
+        if (movable) {
+            replay->slots[hole] = replay->slots[i];
+            hole = i;
+        }
+    }
+    replay->slots[hole].id = 0;
+}
+
+static void track(Replay *replay, uint64_t id, void *ptr, size_t size) {
+    if (!id) return;
+    if (!ptr) {
+        replay->failures++;
+        return;
+    }
+
+    Slot *slot = find_slot(replay, id);
+    if (slot->id) {
+        // Another thread was handed this address before its release was
+        // recorded; the stale block is leaked rather than guessed at
+        replay->reused_ids++;
+        replay->live_bytes -= slot->size;
+    }
+    slot->id = id;
+    slot->ptr = ptr;
+    slot->size = size;
+
+    replay->live_bytes += size;
+    if (replay->live_bytes > replay->peak_live_bytes) replay->peak_live_bytes = replay->live_bytes;
+}
+
+static void *untrack(Replay *replay, uint64_t id, int *found) {
+    Slot *slot = find_slot(replay, id);
+
+    *found = slot->id != 0;
+    if (!slot->id) return NULL;
+
+    void *ptr = slot->ptr;
+    replay->live_bytes -= slot->size;
+    remove_slot(replay, slot);
+    return ptr;
+}
+
+static void replay_record(Replay *replay, TraceRecord *record) {
+    int found = 0;
+
+    switch (record->op) {
+        case TRACE_MALLOC: {
+            void *ptr = malloc(record->size);
+            if (ptr) memset(ptr, 0, record->size < 64 ? record->size : 64);
+            track(replay, record->ptr, ptr, record->size);
+            break;
+        }
+        case TRACE_FREE: {
+            void *ptr = untrack(replay, record->ptr, &found);
+            if (found) free(ptr);
+            else replay->unknown_frees++;
+            break;
+        }
+        case TRACE_REALLOC: {
+            void *old = record->old_ptr ? untrack(replay, record->old_ptr, &found) : NULL;
+            if (record->old_ptr && !found) replay->unknown_frees++;
+
+            void *ptr = realloc(old, record->size);
+            track(replay, record->ptr, ptr, record->size);
+            break;
+        }
+    }
+}
+
+int main(int argc, char **argv) {
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s <file.trace>\n", argv[0]);
+        return 2;
+    }
+
+    int fd = open(argv[1], O_RDONLY);
+    struct stat info;
+    if (fd < 0 || fstat(fd, &info) < 0 || (size_t)info.st_size < sizeof(TraceHeader)) {
+        perror(argv[1]);
+        return 1;
+    }
+
+    char *file = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    TraceHeader *header = (TraceHeader *)file;
+    if (file == MAP_FAILED || memcmp(header->magic, TRACE_MAGIC, sizeof(header->magic)) ||
+        header->version != TRACE_VERSION || header->chunk_size != sizeof(TraceChunk)) {
+        fprintf(stderr, "%s: not a version %d trace\n", argv[1], TRACE_VERSION);
+        return 1;
+    }
+
+    const char *data = file + sizeof(TraceHeader);
+    size_t data_size = (size_t)info.st_size - sizeof(TraceHeader);
+    size_t count = count_records(data, data_size);
+    TraceRecord *records = map_memory(count * sizeof(TraceRecord) + 1);
+    if (!records) return 1;
+    count = decode_records(data, data_size, records);
+    munmap(file, (size_t)info.st_size);
+    close(fd);
+
+    // Per-thread runs are already sorted, so this mostly merges them
+    qsort(records, count, sizeof(TraceRecord), compare_records);
+
+    Replay replay;
+    memset(&replay, 0, sizeof(replay));
+    size_t slot_count = 1024;
+    while (slot_count < count * 2) slot_count <<= 1;
+    replay.slots = map_memory(slot_count * sizeof(Slot));
+    replay.mask = slot_count - 1;
+    if (!replay.slots) return 1;
+    memset(replay.slots, 0, slot_count * sizeof(Slot));
+
+    // RSS is sampled every RSS_SAMPLE_PERIOD records; the peak between two
+    // samples can be missed, which only ever understates fragmentation by
+    // that much
+    int statm_fd = open("/proc/self/statm", O_RDONLY);
+    long baseline_rss = current_rss_kb(statm_fd);
+    long peak_rss = baseline_rss;
+    uint64_t start = now_ns();
+    for (size_t i = 0; i < count; i++) {
+        replay_record(&replay, &records[i]);
+        if (i % RSS_SAMPLE_PERIOD == 0) {
+            long current = current_rss_kb(statm_fd);
+            if (current > peak_rss) peak_rss = current;
+        }
+    }
+    uint64_t elapsed = now_ns() - start;
+    long current = current_rss_kb(statm_fd);
+    if (current > peak_rss) peak_rss = current;
+    long rss = peak_rss - baseline_rss;
+    if (statm_fd >= 0) close(statm_fd);
+
+    double seconds = (double)elapsed / 1e9;
+    double fragmentation = rss > 0 ? 1.0 - (double)replay.peak_live_bytes / 1024.0 / (double)rss : 0.0;
+
+    printf("records        %zu\n", count);
+    printf("time           %.3f s (%.2f Mops/s)\n", seconds, (double)count / seconds / 1e6);
+    printf("peak live      %zu KB\n", replay.peak_live_bytes / 1024);
+    printf("peak RSS       %ld KB above baseline\n", rss);
+    printf("fragmentation  %.1f%% of peak RSS not live\n", fragmentation < 0 ? 0.0 : fragmentation * 100);
+    if (replay.unknown_frees || replay.reused_ids || replay.failures) {
+        printf("skipped        %zu unknown frees, %zu reused ids, %zu failed allocations\n",
+               replay.unknown_frees, replay.reused_ids, replay.failures);
+    }
+    return 0;
+}
@@ -0,0 +1,308 @@
+// Offline analyzer for heap snapshots written by malloc_snapshot().
+//
+// Usage:
+//   snapshot summary <file>       per-class totals and allocated size histogram
+//   snapshot leaks <file>         allocated blocks no other block points to,
+//                                 grouped by size (needs SNAPSHOT_CONTENTS)
+//   snapshot diff <old> <new>     blocks allocated in <new> but not in <old>,
+//                                 grouped by size, largest growth first
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "snapshot.h"
+
+#define TOP_GROUPS 20
+#define SIZE_BUCKETS 40
+
+typedef struct Allocation {
+    uint64_t address;
+    uint64_t size;
+    const unsigned char *contents;
+    uint32_t type;
+    int referenced;
+    int changed;
+} Allocation;
+
+typedef struct Snapshot {
+    SnapshotHeader header;
+    uint64_t zone_bytes[3];
+    uint64_t zones[3];
+    uint64_t free_bytes[3];
+    Allocation *allocations;
+    size_t count;
+} Snapshot;
+
+typedef struct Group {
+    uint64_t size;
+    long long count;
+    long long bytes;
+} Group;
+
+static const char *class_names[3] = {"TINY", "SMALL", "LARGE"};
+
+// Every count and size in the file is checked against the bytes actually
+// there before it is used, so a truncated or corrupt file is rejected
+// rather than read past its end. On success the file stays mapped, since
+// allocations point at their contents inside it.
+static int load(const char *path, Snapshot *snapshot) {
+    int fd = open(path, O_RDONLY);
+    struct stat info;
+
+    if (fd < 0 || fstat(fd, &info) < 0) {
+        perror(path);
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+    size_t file_size = (size_t)info.st_size;
+    const char *data = MAP_FAILED;
+    if (file_size >= sizeof(SnapshotHeader)) data = mmap(NULL, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        fprintf(stderr, "%s: cannot read snapshot\n", path);
+        return -1;
+    }
+
+    memset(snapshot, 0, sizeof(Snapshot));
+    memcpy(&snapshot->header, data, sizeof(SnapshotHeader));
+    if (memcmp(snapshot->header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) ||
+        snapshot->header.version != SNAPSHOT_VERSION) {
+        fprintf(stderr, "%s: not a version %d snapshot\n", path, SNAPSHOT_VERSION);
+        goto fail;
+    }
+    if (snapshot->header.block_count > file_size / sizeof(SnapshotBlock)) {
+        fprintf(stderr, "%s: truncated snapshot\n", path);
+        goto fail;
+    }
+
+    snapshot->allocations = calloc(snapshot->header.block_count + 1, sizeof(Allocation));
+    if (!snapshot->allocations) goto fail;
+
+    const char *end = data + file_size;
+    const char *cursor = data + sizeof(SnapshotHeader);
+    uint64_t block_total = 0;
+    for (uint64_t z = 0; z < snapshot->header.zone_count; z++) {
+        if ((size_t)(end - cursor) < sizeof(SnapshotZone)) {
+            fprintf(stderr, "%s: truncated snapshot\n", path);
+            goto fail;
+        }
+        const SnapshotZone *zone = (const SnapshotZone *)cursor;
+        const SnapshotBlock *blocks = (const SnapshotBlock *)(zone + 1);
+
+        if (zone->block_count > (size_t)(end - (const char *)blocks) / sizeof(SnapshotBlock)) {
+            fprintf(stderr, "%s: truncated snapshot\n", path);
+            goto fail;
+        }
+        block_total += zone->block_count;
+        if (zone->type > 2 || block_total > snapshot->header.block_count) {
+            fprintf(stderr, "%s: corrupt snapshot\n", path);
+            goto fail;
+        }
+        cursor = (const char *)(blocks + zone->block_count);
+        snapshot->zones[zone->type]++;
+        snapshot->zone_bytes[zone->type] += zone->size;
+
+        for (uint32_t i = 0; i < zone->block_count; i++) {
+            if (blocks[i].status != SNAPSHOT_ALLOCATED) {
+                snapshot->free_bytes[zone->type] += blocks[i].size;
+                continue;
+            }
+            if (blocks[i].slack > blocks[i].size) {
+                fprintf(stderr, "%s: corrupt snapshot\n", path);
+                goto fail;
+            }
+            Allocation *allocation = &snapshot->allocations[snapshot->count++];
+            allocation->address = blocks[i].address;
+            allocation->size = blocks[i].size - blocks[i].slack;
+            allocation->type = zone->type;
+        }
+    }
+
+    // Payloads follow in record order, each as large as its block; the
+    // records were all bounds-checked above
+    if (snapshot->header.flags & SNAPSHOT_CONTENTS) {
+        const char *block_cursor = data + sizeof(SnapshotHeader);
+        size_t index = 0;
+
+        for (uint64_t z = 0; z < snapshot->header.zone_count; z++) {
+            const SnapshotZone *zone = (const SnapshotZone *)block_cursor;
+            const SnapshotBlock *blocks = (const SnapshotBlock *)(zone + 1);
+            block_cursor = (const char *)(blocks + zone->block_count);
+
+            for (uint32_t i = 0; i < zone->block_count; i++) {
+                if (blocks[i].status != SNAPSHOT_ALLOCATED) continue;
+                if (blocks[i].size > (size_t)(end - cursor)) {
+                    fprintf(stderr, "%s: truncated contents\n", path);
+                    goto fail;
+                }
+                snapshot->allocations[index++].contents = (const unsigned char *)cursor;
+                cursor += blocks[i].size;
+            }
+        }
+    }
+    return 0;
+
+fail:
+    free(snapshot->allocations);
+    snapshot->allocations = NULL;
+    munmap((void *)data, file_size);
+    return -1;
+}
+
+static int compare_address(const void *a, const void *b) {
+    const Allocation *left = a, *right = b;
+    return (left->address > right->address) - (left->address < right->address);
+}
+
+static int compare_size(const void *a, const void *b) {
+    const uint64_t *left = a, *right = b;
+    return (*left > *right) - (*left < *right);
+}
+
+static int compare_groups(const void *a, const void *b) {
+    const Group *left = a, *right = b;
+    return (right->bytes > left->bytes) - (right->bytes < left->bytes);
+}
+
+static Allocation *find_allocation(Snapshot *snapshot, uint64_t address) {
+    size_t low = 0, high = snapshot->count;
+
+    while (low < high) {
+        size_t mid = (low + high) / 2;
+        Allocation *allocation = &snapshot->allocations[mid];
+
+        if (address < allocation->address) high = mid;
+        else if (address >= allocation->address + allocation->size) low = mid + 1;
+        else return allocation;
+    }
+    return NULL;
+}
+
+// Groups the selected allocations by requested size and prints the groups
+// holding the most bytes
+static void print_groups(Snapshot *snapshot, int (*selected)(Allocation *), const char *title) {
+    uint64_t *sizes = calloc(snapshot->count + 1, sizeof(uint64_t));
+    Group *groups = calloc(snapshot->count + 1, sizeof(Group));
+    size_t size_count = 0, group_count = 0;
+
+    for (size_t i = 0; i < snapshot->count; i++) {
+        if (selected(&snapshot->allocations[i])) sizes[size_count++] = snapshot->allocations[i].size;
+    }
+    qsort(sizes, size_count, sizeof(uint64_t), compare_size);
+
+    for (size_t i = 0; i < size_count; i++) {
+        if (!group_count || groups[group_count - 1].size != sizes[i]) groups[group_count++].size = sizes[i];
+        groups[group_count - 1].count++;
+        groups[group_count - 1].bytes += (long long)sizes[i];
+    }
+    qsort(groups, group_count, sizeof(Group), compare_groups);
+
+    printf("%s\n", title);
+    for (size_t g = 0; g < group_count && g < TOP_GROUPS; g++) {
+        printf("  %10lld bytes in %8lld blocks of %llu bytes\n", groups[g].bytes, groups[g].count,
+               (unsigned long long)groups[g].size);
+    }
+    free(groups);
+    free(sizes);
+}
+
+static int summary(Snapshot *snapshot) {
+    uint64_t histogram[SIZE_BUCKETS] = {0};
+    uint64_t bytes[3] = {0}, blocks[3] = {0};
+
+    for (size_t i = 0; i < snapshot->count; i++) {
+        Allocation *allocation = &snapshot->allocations[i];
+        int bucket = allocation->size ? 63 - __builtin_clzll(allocation->size) : 0;
+
+        histogram[bucket < SIZE_BUCKETS ? bucket : SIZE_BUCKETS - 1]++;
+        bytes[allocation->type] += allocation->size;
+        blocks[allocation->type]++;
+    }
+
+    printf("%llu zones, %llu blocks, %zu allocated\n", (unsigned long long)snapshot->header.zone_count,
+           (unsigned long long)snapshot->header.block_count, snapshot->count);
+    for (int type = 0; type < 3; type++) {
+        printf("  %-5s %6llu zones, %12llu bytes mapped, %12llu requested in %llu blocks, %12llu free\n",
+               class_names[type], (unsigned long long)snapshot->zones[type],
+               (unsigned long long)snapshot->zone_bytes[type], (unsigned long long)bytes[type],
+               (unsigned long long)blocks[type], (unsigned long long)snapshot->free_bytes[type]);
+    }
+
+    printf("allocated sizes\n");
+    for (int i = 0; i < SIZE_BUCKETS; i++) {
+        if (histogram[i]) printf("  %10llu+ : %llu\n", 1ULL << i, (unsigned long long)histogram[i]);
+    }
+    return 0;
+}
+
+static int is_unreferenced(Allocation *allocation) {
+    return !allocation->referenced;
+}
+
+// Scans every allocated payload for words that point into another
+// allocation. Roots outside the heap (stacks, globals) are not in the
+// snapshot, so blocks only they reach show up as candidates too.
+static int leaks(Snapshot *snapshot) {
+    if (!(snapshot->header.flags & SNAPSHOT_CONTENTS)) {
+        fprintf(stderr, "leaks needs a snapshot taken with SNAPSHOT_CONTENTS\n");
+        return 1;
+    }
+    qsort(snapshot->allocations, snapshot->count, sizeof(Allocation), compare_address);
+
+    for (size_t i = 0; i < snapshot->count; i++) {
+        Allocation *allocation = &snapshot->allocations[i];
+        for (uint64_t offset = 0; offset + sizeof(uint64_t) <= allocation->size; offset += sizeof(uint64_t)) {
+            uint64_t word;
+            memcpy(&word, allocation->contents + offset, sizeof(word));
+
+            Allocation *target = find_allocation(snapshot, word);
+            if (target && target != allocation) target->referenced = 1;
+        }
+    }
+    print_groups(snapshot, is_unreferenced, "allocations not referenced from the heap");
+    return 0;
+}
+
+static int is_changed(Allocation *allocation) {
+    return allocation->changed;
+}
+
+// An allocation is unchanged when the same address holds a block of the
+// same size in both snapshots
+static int diff(Snapshot *old, Snapshot *new) {
+    qsort(old->allocations, old->count, sizeof(Allocation), compare_address);
+
+    size_t unchanged = 0;
+    for (size_t i = 0; i < new->count; i++) {
+        Allocation *allocation = &new->allocations[i];
+        Allocation *before = find_allocation(old, allocation->address);
+
+        allocation->changed = !before || before->address != allocation->address || before->size != allocation->size;
+        unchanged += (size_t)!allocation->changed;
+    }
+
+    printf("%zu allocations before, %zu after, %zu unchanged\n", old->count, new->count, unchanged);
+    print_groups(new, is_changed, "allocations new since the first snapshot");
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    Snapshot first, second;
+
+    if (argc == 3 && !strcmp(argv[1], "summary")) {
+        return load(argv[2], &first) ? 1 : summary(&first);
+    }
+    if (argc == 3 && !strcmp(argv[1], "leaks")) {
+        return load(argv[2], &first) ? 1 : leaks(&first);
+    }
+    if (argc == 4 && !strcmp(argv[1], "diff")) {
+        if (load(argv[2], &first) || load(argv[3], &second)) return 1;
+        return diff(&first, &second);
+    }
+    fprintf(stderr, "usage: %s summary <file> | leaks <file> | diff <old> <new>\n", argv[0]);
+    return 2;
+}